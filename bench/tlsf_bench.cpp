@@ -0,0 +1,119 @@
+// 等分割数(NBit1)毎の内部損失と確保/解放時間の比較
+// 使い方: make bench && ./tlsf_bench [操作回数]
+// ランダムなスロットに対して確保(16B〜64KBの対数一様)と解放を繰り返し，
+// 生存ブロックの (ブロックサイズ - 要求サイズ) / 要求サイズ を内部損失として集計する
+#include "../tlsf.h"
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+	using namespace rs;
+	// 64MBの領域，第1レベル32段 (最小ブロックサイズを1にして第2レベルの効果だけを見る)
+	const int NMEM = 26,
+			NBIT0 = 5,
+			N_SLOT = 4096,
+			N_WARMUP = 100000;
+
+	struct Rand {
+		u32 value;
+		Rand(u32 seed): value(seed) {}
+		u32 operator()() {
+			value ^= value << 13;
+			value ^= value >> 17;
+			value ^= value << 5;
+			return value;
+		}
+	};
+	size_t RandSize(Rand& rnd) {
+		int e = 4 + rnd()%12;
+		return (size_t(1)<<e) + rnd()%(size_t(1)<<e);
+	}
+	typedef std::chrono::steady_clock Clock;
+	u32 ElapsedNs(Clock::time_point t0, Clock::time_point t1) {
+		return (u32)std::chrono::duration_cast<std::chrono::nanoseconds>(t1-t0).count();
+	}
+
+	template <int NBit1>
+	void Run(int nOp) {
+		typedef TLSF<NMEM,NBIT0,NBit1,false> Alc;
+		const size_t sz = (size_t(1)<<NMEM)-1;
+		u8* buff = new u8[sz];
+		// (初回アクセスのページフォルトを計測に含めない)
+		memset(buff, 0, sz);
+		Alc* alc = new Alc(buff, sz);
+
+		void* ptr[N_SLOT] = {};
+		size_t req[N_SLOT] = {};
+		// 生存ブロックの要求サイズ/ペイロードサイズ合計
+		size_t sumReq = 0,
+			sumSeg = 0;
+		double wasteAcc = 0;
+		int nSample = 0,
+			nFail = 0;
+		std::vector<u32> lat;
+		lat.reserve(nOp);
+		Rand rnd(0x9e3779b9);
+		for(int i=0 ; i<N_WARMUP+nOp ; i++) {
+			int j = rnd() % N_SLOT;
+			const bool bMeasure = i >= N_WARMUP;
+			Clock::time_point t0, t1;
+			if(ptr[j]) {
+				size_t seg = alc->getSegmentSize(ptr[j]);
+				t0 = Clock::now();
+				alc->release(ptr[j]);
+				t1 = Clock::now();
+				sumReq -= req[j];
+				sumSeg -= seg;
+				ptr[j] = nullptr;
+			} else {
+				size_t s = RandSize(rnd);
+				t0 = Clock::now();
+				ptr[j] = alc->acquire(s);
+				t1 = Clock::now();
+				if(!ptr[j]) {
+					++nFail;
+					continue;
+				}
+				req[j] = s;
+				sumReq += s;
+				sumSeg += alc->getSegmentSize(ptr[j]);
+			}
+			if(bMeasure) {
+				lat.push_back(ElapsedNs(t0, t1));
+				if((i & 1023) == 0 && sumReq > 0) {
+					wasteAcc += double(sumSeg-sumReq) / double(sumReq);
+					++nSample;
+				}
+			}
+		}
+		std::sort(lat.begin(), lat.end());
+		double mean = 0;
+		for(u32 v : lat)
+			mean += v;
+		mean /= lat.size();
+		std::printf("%5d %9zu %7.3f%% %9.1f %8u %8u %8u %6d\n",
+			NBit1, sizeof(Alc), 100.0*wasteAcc/nSample, mean,
+			lat[lat.size()*99/100], lat[lat.size()*999/1000], lat.back(), nFail);
+
+		for(auto* p : ptr) {
+			if(p)
+				alc->release(p);
+		}
+		alc->destroy();
+		delete[] buff;
+	}
+}
+
+int main(int argc, char** argv) {
+	int nOp = argc > 1 ? std::atoi(argv[1]) : 2000000;
+	std::printf("NBit1  ctrl(B)   waste   mean(ns)  p99(ns) p999(ns)  max(ns)   fail\n");
+	Run<4>(nOp);
+	Run<5>(nOp);
+	Run<6>(nOp);
+	Run<7>(nOp);
+	Run<8>(nOp);
+	return 0;
+}
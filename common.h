@@ -2,7 +2,9 @@
 
 // #define MSVC
 #define USEASM_BITSEARCH
-#define TLSF_MEMFILL
+#ifndef TLSF_NO_MEMFILL
+	#define TLSF_MEMFILL
+#endif
 	
 #include <stdint.h>
 #include <stddef.h>
@@ -12,6 +14,15 @@
 #include <assert.h>
 #include <iostream>
 #include <new>
+#ifdef MSVC
+	#include <intrin.h>
+#endif
+#include <limits>
+#include <functional>
+#ifndef MSVC
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
 #include "type.h"
 
 typedef uint8_t u8;
@@ -41,40 +52,79 @@ namespace Bit {
 		x = x | (x >>16);
 		return x & ~(x>>1);
 	}
-	// ビットの位置を計算	
-	#ifdef USEASM_BITSEARCH
+	// De Bruijn列による表引き版 (組み込み関数が使えない時の代替．0の時はMSB_T=0, LSB_T=31)
+	// (乗数は奇数でないと最上位ビットが0番と衝突する)
+	const u8 SB_TABLE[32] = {
+		0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+		31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+	};
+	inline u32 MSB_T(u32 x) {
+		return SB_TABLE[0x077cb531U * LowClear(x | 0x01) >> 27];
+	}
+	inline u32 LSB_T(u32 x) {
+		x |= 0x80000000;
+		return SB_TABLE[0x077cb531U * (x & -x) >> 27];
+	}
+	// 64bit版 (上位/下位32bitに分けて調べる．0の時はMSB_T=0, LSB_T=63)
+	inline u32 MSB_T(u64 x) {
+		u32 hi = u32(x >> 32);
+		return hi ? MSB_T(hi)+32 : MSB_T(u32(x));
+	}
+	inline u32 LSB_T(u64 x) {
+		u32 lo = u32(x);
+		return lo ? LSB_T(lo) : LSB_T(u32(x >> 32))+32;
+	}
+	// ビットの位置を計算 (0の時はMSB_N=0, LSB_N=31)
+	// USEASM_BITSEARCH: コンパイラ組み込み関数でbsr/bsf (-mlzcnt/-mbmi指定時はlzcnt/tzcnt)を使う
+	#if defined(USEASM_BITSEARCH) && defined(__GNUC__)
+		inline u32 MSB_N(u32 x) {
+			return 31 - __builtin_clz(x | 0x01);
+		}
+		inline u32 LSB_N(u32 x) {
+			return __builtin_ctz(x | 0x80000000);
+		}
+		inline u32 MSB_N(u64 x) {
+			return 63 - __builtin_clzll(x | 0x01);
+		}
+		inline u32 LSB_N(u64 x) {
+			return __builtin_ctzll(x | 0x8000000000000000ULL);
+		}
+	#elif defined(USEASM_BITSEARCH) && defined(MSVC)
 		inline u32 MSB_N(u32 x) {
-			#ifdef MSVC
-				__asm or [x], 0x01
-				__asm bsr eax, dword ptr[x]
-			#else
-				__asm__("or %0, 0x01\n\t"
-						"bsr eax, %0"
-						:
-						:"q"(x)
-				);
-			#endif
+			unsigned long idx;
+			_BitScanReverse(&idx, x | 0x01);
+			return idx;
 		}
 		inline u32 LSB_N(u32 x) {
-			#ifdef MSVC
-				__asm or [x], 0x80000000
-				__asm bsf eax, dword ptr[x]
-			#else
-				__asm__("or %0, 0x80000000\n\t"
-						"bsf eax, %0"
-					   :
-					   :"q"(x));
-			#endif
+			unsigned long idx;
+			_BitScanForward(&idx, x | 0x80000000);
+			return idx;
 		}
 	#else
-		const char SB_TABLE[] = "\x00\x00\x01\x0e\x1c\x02\x16\x0f\x1d\x1a\x03\x05\x0b\x17"
-							"\x07\x10\x1e\x0d\x1b\x15\x19\x04\x0a\x06\x0c\x14\x18\x09"
-							"\x13\x08\x12\x11";
 		inline u32 MSB_N(u32 x) {
-			return SB_TABLE[0x0aec7cd2U * LowClear(x) >> 27];
+			return MSB_T(x);
 		}
 		inline u32 LSB_N(u32 x) {
-			return SB_TABLE[0x0aec7cd2U * (x & -x) >> 27];
+			return LSB_T(x);
 		}
 	#endif
+	#if !defined(USEASM_BITSEARCH) || !defined(__GNUC__)
+		// 64bit版 (上位/下位32bitに分けて調べる．0の時はMSB_N=0, LSB_N=63)
+		inline u32 MSB_N(u64 x) {
+			u32 hi = u32(x >> 32);
+			return hi ? MSB_N(hi)+32 : MSB_N(u32(x));
+		}
+		inline u32 LSB_N(u64 x) {
+			u32 lo = u32(x);
+			return lo ? LSB_N(lo) : LSB_N(u32(x >> 32))+32;
+		}
+	#endif
+	// コンパイル時計算用
+	constexpr u32 MSB_C(u64 x) {
+		return x <= 1 ? 0 : MSB_C(x >> 1) + 1;
+	}
+	// 2を底とする対数 (切り上げ)
+	constexpr u32 CeilLog2(u64 x) {
+		return x <= 1 ? 0 : MSB_C(x - 1) + 1;
+	}
 }
@@ -0,0 +1,280 @@
+// LD_PRELOAD用 malloc/free置き換え
+// プロセス全体で1つのTLSFBlockを使い，mutexで保護する
+// 使い方: LD_PRELOAD=./libtlsf_preload.so <program>
+#include "../tlsf.h"
+#include <pthread.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <new>
+
+namespace {
+	using namespace rs;
+	typedef TLSFBlock<24,4,4>	Heap;
+	// mallocが返すアラインメント
+	const size_t ALIGN = 16;
+	// これより大きな要求はmmapで直接確保する
+	const size_t MAXHEAP = ((1<<24)-1) / 2;
+
+	alignas(Heap) u8	g_heapBuff[sizeof(Heap)];
+	Heap*				g_heap = nullptr;
+	pthread_mutex_t		g_mtx = PTHREAD_MUTEX_INITIALIZER;
+	// ヒープ操作中(ロック保持中)にmalloc系が再入した時に立つ
+	// (TLSFBlockが内部でnewを呼ぶ為．その場合はmmapへ回す)
+	__thread bool		t_inside __attribute__((tls_model("initial-exec"))) = false;
+
+	// ユーザーポインタの直前に確保元の先頭アドレスを置く
+	// (TLSFのペイロードはアラインされていないのでずらして返す)
+	void*& RawPtr(void* q) {
+		return *(void**)((uintptr_t)q - sizeof(void*));
+	}
+	size_t PaddedSize(size_t s, size_t align) {
+		size_t need = s + align-1 + sizeof(void*);
+		return need < s ? 0 : need;
+	}
+	void* AlignUp(void* raw, size_t align) {
+		uintptr_t q = ((uintptr_t)raw + sizeof(void*) + align-1) & ~(uintptr_t)(align-1);
+		RawPtr((void*)q) = raw;
+		return (void*)q;
+	}
+
+	// mmapで直接確保する領域 (先頭にマッピング長を置く)
+	void* AllocChunk(size_t need) {
+		size_t pg = sysconf(_SC_PAGESIZE),
+				len = (need + sizeof(size_t) + pg-1) & ~(pg-1);
+		if(len < need)
+			return nullptr;
+		void* base = mmap(nullptr, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if(base == MAP_FAILED)
+			return nullptr;
+		*(size_t*)base = len;
+		return (void*)((uintptr_t)base + sizeof(size_t));
+	}
+	void FreeChunk(void* raw) {
+		void* base = (void*)((uintptr_t)raw - sizeof(size_t));
+		munmap(base, *(size_t*)base);
+	}
+	size_t ChunkSize(void* raw) {
+		return *(size_t*)((uintptr_t)raw - sizeof(size_t)) - sizeof(size_t);
+	}
+
+	void* Alloc(size_t s, size_t align, bool bZero) {
+		align = std::max(align, ALIGN);
+		size_t need = PaddedSize(s, align);
+		if(need == 0)
+			return nullptr;
+		void* raw = nullptr;
+		if(t_inside || need > MAXHEAP)
+			raw = AllocChunk(need);
+		else {
+			pthread_mutex_lock(&g_mtx);
+			t_inside = true;
+			try {
+				if(!g_heap)
+					g_heap = new(g_heapBuff) Heap();
+				raw = bZero ? g_heap->acquireZero(need) : g_heap->acquire(need);
+			} catch(const std::bad_alloc&) {
+				raw = nullptr;
+			}
+			t_inside = false;
+			pthread_mutex_unlock(&g_mtx);
+		}
+		return raw ? AlignUp(raw, align) : nullptr;
+	}
+	void Free(void* q) {
+		if(!q)
+			return;
+		void* raw = RawPtr(q);
+		bool bInside = t_inside,
+			bHeap;
+		if(!bInside)
+			pthread_mutex_lock(&g_mtx);
+		if((bHeap = g_heap && g_heap->hasPointer(raw))) {
+			t_inside = true;
+			g_heap->release(raw);
+			t_inside = bInside;
+		}
+		if(!bInside)
+			pthread_mutex_unlock(&g_mtx);
+		if(!bHeap)
+			FreeChunk(raw);
+	}
+	size_t UsableSize(void* q) {
+		if(!q)
+			return 0;
+		void* raw = RawPtr(q);
+		size_t sz, ofs = (uintptr_t)q - (uintptr_t)raw;
+		bool bInside = t_inside;
+		if(!bInside)
+			pthread_mutex_lock(&g_mtx);
+		if(g_heap && g_heap->hasPointer(raw))
+			sz = g_heap->getSegmentSize(raw);
+		else
+			sz = ChunkSize(raw);
+		if(!bInside)
+			pthread_mutex_unlock(&g_mtx);
+		return sz - ofs;
+	}
+	void* Realloc(void* q, size_t s) {
+		if(!q)
+			return Alloc(s, ALIGN, false);
+		if(s == 0) {
+			Free(q);
+			return nullptr;
+		}
+		size_t cur = UsableSize(q);
+		if(s <= cur)
+			return q;
+		// ヒープ内のブロックはTLSFBlock::reacquireで伸長する
+		// (後続の空きブロックに広げられればコピーが要らない．mmap領域は確保し直してコピー)
+		void* raw = RawPtr(q);
+		size_t need = PaddedSize(s, ALIGN),
+				ofs = (uintptr_t)q - (uintptr_t)raw;
+		if(!t_inside && need != 0 && need <= MAXHEAP && ofs <= ALIGN-1 + sizeof(void*)) {
+			void* nraw = nullptr;
+			bool bHeap;
+			pthread_mutex_lock(&g_mtx);
+			if((bHeap = g_heap && g_heap->hasPointer(raw))) {
+				t_inside = true;
+				try {
+					nraw = g_heap->reacquire(raw, need);
+				} catch(const std::bad_alloc&) {
+					nraw = nullptr;
+				}
+				t_inside = false;
+			}
+			pthread_mutex_unlock(&g_mtx);
+			if(bHeap) {
+				// (失敗時は元のブロックがそのまま残る)
+				if(!nraw)
+					return nullptr;
+				// 確保元の先頭が動いてアラインメントがずれた場合は中身を詰め直す
+				void* nq = (void*)(((uintptr_t)nraw + sizeof(void*) + ALIGN-1) & ~(uintptr_t)(ALIGN-1));
+				void* src = (void*)((uintptr_t)nraw + ofs);
+				if(nq != src)
+					memmove(nq, src, cur);
+				RawPtr(nq) = nraw;
+				return nq;
+			}
+		}
+		void* nq = Alloc(s, ALIGN, false);
+		if(nq) {
+			memcpy(nq, q, cur);
+			Free(q);
+		}
+		return nq;
+	}
+	bool IsPow2(size_t a) {
+		return a != 0 && (a & (a-1)) == 0;
+	}
+
+	void* NewImpl(size_t s, size_t align) {
+		for(;;) {
+			if(void* p = Alloc(s, align, false))
+				return p;
+			std::new_handler h = std::get_new_handler();
+			if(!h)
+				throw std::bad_alloc();
+			h();
+		}
+	}
+
+	// fork時にロックを持ったまま子プロセスへ引き継がないようにする
+	void AtForkPrepare() { pthread_mutex_lock(&g_mtx); }
+	void AtForkParent() { pthread_mutex_unlock(&g_mtx); }
+	void AtForkChild() { pthread_mutex_init(&g_mtx, nullptr); }
+	__attribute__((constructor)) void Init() {
+		pthread_atfork(AtForkPrepare, AtForkParent, AtForkChild);
+	}
+}
+
+extern "C" {
+	void* malloc(size_t s) {
+		void* p = Alloc(s, ALIGN, false);
+		if(!p)
+			errno = ENOMEM;
+		return p;
+	}
+	void free(void* p) {
+		Free(p);
+	}
+	void* calloc(size_t n, size_t s) {
+		size_t total;
+		if(__builtin_mul_overflow(n, s, &total)) {
+			errno = ENOMEM;
+			return nullptr;
+		}
+		void* p = Alloc(total, ALIGN, true);
+		if(!p)
+			errno = ENOMEM;
+		return p;
+	}
+	void* realloc(void* p, size_t s) {
+		void* ret = Realloc(p, s);
+		if(!ret && s)
+			errno = ENOMEM;
+		return ret;
+	}
+	void* reallocarray(void* p, size_t n, size_t s) {
+		size_t total;
+		if(__builtin_mul_overflow(n, s, &total)) {
+			errno = ENOMEM;
+			return nullptr;
+		}
+		return realloc(p, total);
+	}
+	int posix_memalign(void** pp, size_t align, size_t s) {
+		if(!IsPow2(align) || align % sizeof(void*) != 0)
+			return EINVAL;
+		void* p = Alloc(s, align, false);
+		if(!p)
+			return ENOMEM;
+		*pp = p;
+		return 0;
+	}
+	void* aligned_alloc(size_t align, size_t s) {
+		if(!IsPow2(align)) {
+			errno = EINVAL;
+			return nullptr;
+		}
+		void* p = Alloc(s, align, false);
+		if(!p)
+			errno = ENOMEM;
+		return p;
+	}
+	void* memalign(size_t align, size_t s) {
+		return aligned_alloc(align, s);
+	}
+	void* valloc(size_t s) {
+		return aligned_alloc(sysconf(_SC_PAGESIZE), s);
+	}
+	void* pvalloc(size_t s) {
+		size_t pg = sysconf(_SC_PAGESIZE);
+		return aligned_alloc(pg, (s + pg-1) & ~(pg-1));
+	}
+	size_t malloc_usable_size(void* p) {
+		return UsableSize(p);
+	}
+}
+
+void* operator new(size_t s) { return NewImpl(s, ALIGN); }
+void* operator new[](size_t s) { return NewImpl(s, ALIGN); }
+void* operator new(size_t s, const std::nothrow_t&) noexcept { return Alloc(s, ALIGN, false); }
+void* operator new[](size_t s, const std::nothrow_t&) noexcept { return Alloc(s, ALIGN, false); }
+void* operator new(size_t s, std::align_val_t a) { return NewImpl(s, (size_t)a); }
+void* operator new[](size_t s, std::align_val_t a) { return NewImpl(s, (size_t)a); }
+void* operator new(size_t s, std::align_val_t a, const std::nothrow_t&) noexcept { return Alloc(s, (size_t)a, false); }
+void* operator new[](size_t s, std::align_val_t a, const std::nothrow_t&) noexcept { return Alloc(s, (size_t)a, false); }
+
+void operator delete(void* p) noexcept { Free(p); }
+void operator delete[](void* p) noexcept { Free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete(void* p, size_t) noexcept { Free(p); }
+void operator delete[](void* p, size_t) noexcept { Free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { Free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { Free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { Free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { Free(p); }
@@ -14,6 +14,93 @@ namespace rs {
 		virtual size_t LowBlockSize() const = 0;
 		virtual void destroy() = 0;
 	};
+	// タグ別の使用量と上限
+	struct TLSFTag {
+		// タグはブロックヘッダの状態フラグの上位6bitに格納する
+		const static int NTag = 64;
+		enum Budget {
+			Budget_None,
+			// 超過時にコールバックで通知し，確保は続行
+			Budget_Soft,
+			// 超過時にコールバックを呼び，trueが返って上限内に収まれば続行，そうでなければ失敗
+			Budget_Hard
+		};
+		// (tag, 現在の使用量, 要求サイズ)
+		typedef std::function<bool (int, size_t, size_t)>	Callback;
+
+		struct Entry {
+			size_t	szLive, nLive, szBudget;
+			Budget	type;
+		};
+		Entry		ent[NTag];
+		Callback	cb;
+
+		TLSFTag() {
+			for(auto& e : ent) {
+				e.szLive = e.nLive = e.szBudget = 0;
+				e.type = Budget_None;
+			}
+		}
+		// 実際に割り当てられ得る最大サイズで判定するか
+		// (sMaxの計算は確保の度に掛かるので，呼び出し側はこれが真の時だけ求める)
+		bool isHard(int tag) const {
+			return ent[tag].type == Budget_Hard;
+		}
+		// サイズsを追加で確保してよいか
+		// (Budget_Hardの場合は実際に割り当てられ得る最大サイズsMaxで判定する．0なら判定しない)
+		bool check(int tag, size_t s, size_t sMax) {
+			size_t sz = ent[tag].type==Budget_Hard ? sMax : s;
+			return sz == 0 || check(tag, sz);
+		}
+		bool check(int tag, size_t s) {
+			Entry& e = ent[tag];
+			if(e.type == Budget_None || e.szLive + s <= e.szBudget)
+				return true;
+			if(e.type == Budget_Soft) {
+				if(cb)
+					cb(tag, e.szLive, s);
+				return true;
+			}
+			return cb && cb(tag, e.szLive, s) && e.szLive + s <= e.szBudget;
+		}
+		void add(int tag, size_t s) {
+			ent[tag].szLive += s;
+			++ent[tag].nLive;
+		}
+		void sub(int tag, size_t s) {
+			ent[tag].szLive -= s;
+			--ent[tag].nLive;
+		}
+		void setBudget(int tag, size_t s, Budget type) {
+			ent[tag].szBudget = s;
+			ent[tag].type = type;
+		}
+		void setCallback(const Callback& c) {
+			cb = c;
+		}
+		size_t getLiveMem(int tag) const {
+			return ent[tag].szLive;
+		}
+		size_t getLiveCount(int tag) const {
+			return ent[tag].nLive;
+		}
+	};
+	// 確保時の寿命ヒント
+	enum TLSFLifetime {
+		LT_Default,
+		// 長寿命: 領域の先頭側(低アドレス)へ詰めて置く
+		LT_Long,
+		// 短寿命: 領域の末尾側へ置く (TLSFBlockでは専用の領域へ分ける)
+		LT_Short
+	};
+	// ヒープ走査で渡すブロック情報
+	struct TLSFBlockInfo {
+		void*	ptr;		// ペイロード先頭
+		size_t	size;		// ペイロードサイズ
+		bool	bUse;		// 使用中か (遅延結合待ちのブロックも使用中扱い)
+		u32		bidx,		// フリーリストインデックス
+				l0, l1;		// bidxを第1/第2レベルのビット位置に分けたもの
+	};
 	#ifdef MSVC
 		#pragma pack(push,1)
 	#else
@@ -22,6 +109,7 @@ namespace rs {
 	template <class TSize, class THead, int MINSIZE>
 	class MBlock {
 		private:
+			// 状態フラグ (FLAG_USE | FLAG_PURGED | タグ<<TAG_SHIFT)
 			u8		_bUse;
 			THead	_head;
 			TSize	_szBlock;
@@ -32,8 +120,15 @@ namespace rs {
 			}
 
 		public:
+			enum {
+				FLAG_USE = 0x01,
+				// ページ内部がOSへ返却済み (ゼロ埋めされている)
+				FLAG_PURGED = 0x02,
+				FLAG_MASK = 0x03,
+				TAG_SHIFT = 2
+			};
 			// メモリブロックHead/Tailダミー用
-			MBlock(bool bTail): _bUse(1), _szBlock(0) {
+			MBlock(bool bTail): _bUse(FLAG_USE), _szBlock(0) {
 				if(bTail)
 					_writeTail();
 			}
@@ -125,7 +220,8 @@ namespace rs {
 			void* useThis(bool bUse) {
 				L_ASSERT(!isUsing(), u8"");
 
-				_bUse = bUse ? 1 : 0;
+				// (返却済みフラグは確保後の判定用に残す)
+				_bUse = (_bUse & ~FLAG_USE) | (bUse ? FLAG_USE : 0);
 				_head.useThis();
 				return payload();
 			}
@@ -133,8 +229,19 @@ namespace rs {
 				return (void*)((intptr_t)this + sizeof(*this));
 			}
 			bool isUsing() const {
-				L_ASSERT(_bUse==0 || _bUse==1, u8"不正な使用中フラグ");
-				return _bUse==1;
+				return (_bUse & FLAG_USE) != 0;
+			}
+			int getTag() const {
+				return _bUse >> TAG_SHIFT;
+			}
+			void setTag(int tag) {
+				_bUse = (_bUse & FLAG_MASK) | (tag << TAG_SHIFT);
+			}
+			bool isPurged() const {
+				return (_bUse & FLAG_PURGED) != 0;
+			}
+			void setPurged(bool b) {
+				_bUse = (_bUse & ~FLAG_PURGED) | (b ? FLAG_PURGED : 0);
 			}
 	};
 	// ブロックサイズを格納するのに必要な型を決定
@@ -147,10 +254,133 @@ namespace rs {
 		enum {result=SUM};
 	};
 
+	// サイズ -> フリーリストインデックスの対応 (コンパイル時計算)
+	template <int NMemBit, int NBit0, int NBit1>
+	struct TLSFIndex {
+		// ブロックインデックスの格納型
+		typedef typename TypeAt<CType<u8, CType<u16> >, ((NBit0+NBit1-1)>>3) >::result TBIdx;
+
+		const static int NDiv0 = 1<<NBit0,
+						NDiv1 = 1<<NBit1,
+						L1MASK = NDiv1-1,
+						// 第1レベルの最小シフト量 (最小ブロックサイズが1未満にならないよう制限)
+						NFS = (NMemBit-NDiv0+1 > NBit1) ? NMemBit-NDiv0+1 : NBit1,
+						LowFLevelSize = 1 << NFS,
+						LowBlockSize = LowFLevelSize >> NBit1;
+
+		static constexpr int FLevel(size_t s) {
+			return (s >> NFS)==0 ? 0 : Bit::MSB_C(s >> NFS)+1;
+		}
+		static constexpr u32 MakeIndex(int fLv, size_t s) {
+			return (fLv << NBit1) | ((s >> (NFS+(fLv>1 ? fLv-1 : 0)-NBit1)) & L1MASK);
+		}
+		static constexpr u32 CalcIndex(size_t s) {
+			return MakeIndex(FLevel(s), s);
+		}
+
+		// 小さいサイズ用の早見表
+		// (LowBlockSize単位で，第1レベルの下位LUT_LEVEL段分)
+		const static int LUT_LEVEL = (NMemBit-NFS < 4) ? NMemBit-NFS : 4,
+						LUT_SHIFT = NFS - NBit1,
+						LUT_N = NDiv1 << LUT_LEVEL;
+		const static size_t LUT_LIMIT = size_t(LowFLevelSize) << LUT_LEVEL;
+		struct Table {
+			TBIdx	value[LUT_N];
+		};
+		template <int... N>
+		static constexpr Table MakeTable(IndexSeq<N...>) {
+			return Table{{ TBIdx(CalcIndex(size_t(N) << LUT_SHIFT))... }};
+		}
+		static const Table LUT;
+
+		static_assert(NBit0 >= 1 && NBit0 <= 5, "L0ビットテーブルは32bit (NBit0 <= 5)");
+		static_assert(NBit1 >= 1 && NBit1 <= 8, "L1ビットテーブルは64bit x 4まで (NBit1 <= 8)");
+		static_assert(NMemBit > NBit1 && NMemBit <= 30, "NMemBitが範囲外");
+	};
+	template <int NMemBit, int NBit0, int NBit1>
+	const typename TLSFIndex<NMemBit,NBit0,NBit1>::Table TLSFIndex<NMemBit,NBit0,NBit1>::LUT =
+		TLSFIndex<NMemBit,NBit0,NBit1>::MakeTable(typename MakeIndexSeq<LUT_N>::type());
+
+	// フリーリストの有無を表すビットテーブル
+	// 第2レベルは最大64bitのワードで持ち，NBit1 > 6で複数ワードになる場合は
+	// ワード毎の有無を表す中間レベルを挟む (どの探索も一定回数のビットスキャンで済む)
+	template <int NBit0, int NBit1>
+	struct TLSFBitmap {
+		const static int NDiv0 = 1<<NBit0,
+						// 第2レベル1ワードのビット数(log2)
+						NWBit = NBit1 < 6 ? NBit1 : 6,
+						NWord = 1 << (NBit1-NWBit);
+		typedef typename TypeAt<CType<u32, CType<u64> >, (NWBit>5) >::result TWord;
+
+		// :level1
+		u32		l0;
+		// :level1.5 (NWord > 1の時のみ使用)
+		u32		lw[NWord>1 ? NDiv0 : 1];
+		// :level2
+		TWord	l1[NDiv0][NWord];
+
+		static u32 L0Bit(u32 bidx) { return bidx >> NBit1; }
+		static u32 WBit(u32 bidx) { return (bidx >> NWBit) & (NWord-1); }
+		static u32 L1Bit(u32 bidx) { return bidx & ((1<<NWBit)-1); }
+		u32& _lw(u32 i0) { return lw[NWord>1 ? i0 : 0]; }
+		u32 _lw(u32 i0) const { return lw[NWord>1 ? i0 : 0]; }
+		// 第1レベルi0の中で最大のインデックス
+		u32 _rowMax(u32 i0) const {
+			u32 iw = NWord>1 ? Bit::MSB_N(_lw(i0)) : 0;
+			return (i0 << NBit1) | (iw << NWBit) | Bit::MSB_N(l1[i0][iw]);
+		}
+
+		void clear() {
+			memset(this, 0, sizeof(*this));
+		}
+		bool empty() const {
+			return l0 == 0;
+		}
+		bool test(u32 bidx) const {
+			return ((l1[L0Bit(bidx)][WBit(bidx)] >> L1Bit(bidx)) & 1) != 0;
+		}
+		void set(u32 bidx) {
+			u32 i0 = L0Bit(bidx),
+				iw = WBit(bidx);
+			l1[i0][iw] |= TWord(1) << L1Bit(bidx);
+			if(NWord > 1)
+				_lw(i0) |= 1u << iw;
+			l0 |= 1u << i0;
+			LA_OUTRANGE(i0 < NDiv0, u8"");
+		}
+		void reset(u32 bidx) {
+			u32 i0 = L0Bit(bidx),
+				iw = WBit(bidx);
+			if((l1[i0][iw] &= ~(TWord(1) << L1Bit(bidx))) != 0)
+				return;
+			if(NWord > 1 && (_lw(i0) &= ~(1u << iw)) != 0)
+				return;
+			l0 &= ~(1u << i0);
+		}
+		// 最大のインデックス (emptyでない事)
+		u32 findMax() const {
+			return _rowMax(Bit::MSB_N(l0));
+		}
+		// bidx以上のインデックスを探す (無ければ-1)
+		// 同じ第1レベルにあればその中で最大の物，無ければより上の第1レベルで最大の物
+		int findFrom(u32 bidx) const {
+			u32 i0 = L0Bit(bidx);
+			if(l0 & (1u << i0)) {
+				u32 r = _rowMax(i0);
+				if(r >= bidx)
+					return r;
+			}
+			// (i0 == 31の時は2u<<i0が0になり，マスクも0になる)
+			u32 bt = l0 & ~((2u << i0) - 1);
+			return bt ? int(_rowMax(Bit::MSB_N(bt))) : -1;
+		}
+	};
+
 	// 2のべき乗分割 = NBit0
 	// 等分割 = NBit1
 	template <int NMemBit, int NBit0, int NBit1, bool BExc>
 	class TLSF : public ImplTLSF {
+		typedef TLSFIndex<NMemBit, NBit0, NBit1>	Index;
 		typedef CType<u8,
 				CType<u16,
 				CType<u32,
@@ -161,12 +391,12 @@ namespace rs {
 			const static int NDiv0 = 1<<NBit0,
 							NDiv1 = 1<<NBit1,
 							L1MASK = NDiv1-1,
-							L1MASKINV = ~L1MASK,
-							_LowFLevelSize = 1 << (NMemBit-NDiv0+1),
-							_LowBlockSize = _LowFLevelSize >> NBit1;
+							NIndex = 1<<(NBit0+NBit1),
+							_LowFLevelSize = Index::LowFLevelSize,
+							_LowBlockSize = Index::LowBlockSize;
 			struct TLSFHead {
 				typedef MBlock<TSize,TLSFHead, _LowBlockSize> MBlk;
-				u8	bidx;
+				typename Index::TBIdx	bidx;
 				MBlk *pPrev, *pNext;
 
 				TLSFHead(int b=0, MBlk* p=nullptr, MBlk* n=nullptr): bidx(b), pPrev(p), pNext(n) {}
@@ -185,31 +415,55 @@ namespace rs {
 			};
 			typedef MBlock<TSize, TLSFHead, _LowBlockSize>	MBlk;
 
+			typedef TLSFBitmap<NBit0, NBit1>	Bitmap;
 			// 2 level table
-			MBlk* _mbIndex[1<<(NBit0+NBit1)];
+			MBlk* _mbIndex[NIndex];
 			// bit table
-			// :level1
-			uint32_t	_btL0;
-			// :level2
-			uint32_t _btL1[NDiv0];
+			Bitmap	_bt;
 
 			void* _src;
 			size_t _sz_src;
 			// 空きメモリカウンタ
 			size_t	_sz_remain;
+			// 初期状態の空きメモリ (全て解放されたかの判定用)
+			size_t	_sz_init;
+
+			// 遅延結合用クイックリスト (クラス毎，pNextで連結)
+			struct QuickList {
+				MBlk*	index[NIndex];
+				Bitmap	bt;
+			};
+			// (setDeferredCoalesceで有効にした時だけ確保する．無効ならnullptr)
+			QuickList*	_quick;
+			// クイックリストに保持しているペイロード量
+			size_t	_sz_quick;
+			// クイックリスト上限 (0で遅延結合無効)
+			size_t	_sz_qBudget;
+			// 一度に結合処理するブロック数
+			int		_nqBatch;
+			// タグ別の使用量
+			TLSFTag	_tag;
+			// 分割走査の再開位置 (走査中でなければnullptr)
+			MBlk*	_walkCur;
+			// 返却済みページがOSによりゼロ埋めされるか (プライベートな匿名メモリのみ)
+			bool	_bPurgeZero;
 
 			struct BIndex {
 				uint32_t	value;
 
 				BIndex(uint32_t v): value(v) {}
 				operator uint32_t() { return value; }
-				uint32_t L0Bit() const { return value>>NBit1; }
-				uint32_t L1Bit() const { return value&L1MASK; }
 			};
 			// メモリブロックフリーリストのインデックス
-			BIndex _calcIndex(size_t s) {
+			// (小さいサイズは早見表を引く)
+			static BIndex _calcIndex(size_t s) {
+				if(s < Index::LUT_LIMIT)
+					return Index::LUT.value[s >> Index::LUT_SHIFT];
+				return _calcIndexBit(s);
+			}
+			static BIndex _calcIndexBit(size_t s) {
 				// First_Level
-				int nFS = NMemBit-NDiv0+1;
+				const int nFS = Index::NFS;
 				u32 tmp = s >> nFS;
 				int fLv = tmp==0 ? 0 : (Bit::MSB_N(tmp)+1);
 				LA_OUTRANGE(fLv<NDiv0, u8"");
@@ -234,15 +488,10 @@ namespace rs {
 				_sz_remain += nblk->getPayloadSize();
 			}
 			void _addFlag(BIndex bidx) {
-				_btL0 |= 1 << bidx.L0Bit();
-				_btL1[bidx.L0Bit()] |= 1 << bidx.L1Bit();
-				LA_OUTRANGE(_btL0 <(1<<NDiv0), u8"");
+				_bt.set(bidx);
 			}
 			void _dropFlag(BIndex bidx) {
-				_btL1[bidx.L0Bit()] &= ~(1 << bidx.L1Bit());
-				if(_btL1[bidx.L0Bit()] == 0)
-					_btL0 &= ~(1 << bidx.L0Bit());
-				LA_OUTRANGE(_btL0 < (1<<NDiv0), u8"");
+				_bt.reset(bidx);
 			}
 			void* _useMB(BIndex bidx) {
 				// 先頭ブロックを使用
@@ -277,6 +526,120 @@ namespace rs {
 				}
 				return blk->payload();
 			}
+			// 後ろ側を使用し，前側を空きブロックとして戻す
+			// (blkはフリーリストから外して使用中にした物)
+			void* _useDivMBTail(MBlk* blk, size_t s) {
+				L_ASSERT(blk->getPayloadSize() >= s, u8"");
+				size_t szUse = MBlk::GetBlockSize(s);
+				if(blk->getPayloadSize() < szUse+_LowBlockSize)
+					return blk->payload();
+				size_t szFront = blk->getBlockSize() - szUse;
+				MBlk* tblk = new((void*)((intptr_t)blk + szFront)) MBlk(szUse, TLSFHead(_calcIndex(s)));
+				tblk->useThis(true);
+				_pushMB(blk, szFront);
+				return tblk->payload();
+			}
+			// 寿命ヒントに合わせてクラスbidxのブロックを選ぶ
+			// (先頭から最大N_PICK個を調べ，長寿命なら最も低いアドレス，短寿命なら最も高いアドレス)
+			MBlk* _pickMB(BIndex bidx, TLSFLifetime lt) {
+				const int N_PICK = 8;
+				MBlk* ret = _mbIndex[bidx];
+				MBlk* blk = ret->header()->pNext;
+				for(int i=1 ; i<N_PICK && blk ; i++, blk=blk->header()->pNext) {
+					if((lt == LT_Long) == (blk < ret))
+						ret = blk;
+				}
+				return ret;
+			}
+			void* _useHint(BIndex bidx, size_t s, TLSFLifetime lt) {
+				if(lt == LT_Default)
+					return _useDivMB(bidx, s);
+				MBlk* blk = _pickMB(bidx, lt);
+				_remBlock(blk, true);
+				return lt==LT_Short ? _useDivMBTail(blk, s) : _useDivMB(blk, s);
+			}
+
+			// 解放ブロックを結合せずにクイックリストへ積む
+			// (ブロックは使用中のまま残すので隣接ブロックから結合されない)
+			void _pushQuick(MBlk* blk) {
+				BIndex bidx(blk->header()->bidx);
+				blk->setPurged(false);
+				blk->header()->pNext = _quick->index[bidx];
+				_quick->index[bidx] = blk;
+				_quick->bt.set(bidx);
+				_sz_quick += blk->getPayloadSize();
+			}
+			MBlk* _popQuick(BIndex bidx) {
+				MBlk* blk = _quick->index[bidx];
+				if(!(_quick->index[bidx] = blk->header()->pNext))
+					_quick->bt.reset(bidx);
+				_sz_quick -= blk->getPayloadSize();
+				return blk;
+			}
+			// サイズsを満たすブロックをクイックリストから取り出す
+			// (同クラスと1つ上のクラスの先頭のみを調べる)
+			void* _useQuick(size_t s) {
+				BIndex bidx = _calcIndex(s);
+				MBlk* blk = _quick->index[bidx];
+				if(!blk || blk->getPayloadSize() < s) {
+					if(bidx+1 >= NIndex || !_quick->index[bidx+1])
+						return nullptr;
+					bidx = bidx+1;
+				}
+				return _popQuick(bidx)->payload();
+			}
+			// クイックリストのブロックを最大n個，通常の解放処理にかける
+			// (大きいクラスから順に処理)
+			void _flushQuick(int n) {
+				for(int i=0 ; i<n && !_quick->bt.empty() ; i++)
+					_releaseMB(_popQuick(_quick->bt.findMax()));
+			}
+			// ブロックgoneがintoへ統合された (走査位置が消えないよう付け替える)
+			void _onMerge(MBlk* gone, MBlk* into) {
+				if(_walkCur == gone)
+					_walkCur = into;
+			}
+			// 前後のブロックと結合してフリーリストへ戻す
+			void _releaseMB(MBlk* blk) {
+				if(blk->canCombinePrev()) {
+					MBlk* bptr = blk->prev();
+					_remBlock(bptr, false);
+					_onMerge(blk, bptr);
+					blk->combinePrev();
+
+					bptr->header()->bidx = _calcIndex(bptr->getPayloadSize());
+					blk = bptr;
+				}
+				if(blk->canCombineNext()) {
+					_remBlock(blk->next(), false);
+					_onMerge(blk->next(), blk);
+					blk->combineNext();
+
+					blk->header()->bidx = _calcIndex(blk->getPayloadSize());
+				}
+
+				_pushMB(blk, blk->getBlockSize());
+			}
+			// フリーリストから確保 (見つからなければnullptr)
+			// lt: 寿命ヒント (LT_Default以外はブロック内の置き場所を選ぶ)
+			void* _acquireMB(size_t s, TLSFLifetime lt) {
+				if(s > _sz_remain)
+					return nullptr;
+
+				BIndex bidx = _calcIndex(s)+1;
+				// (最上位クラスの要求は確実に収まるクラスが無い)
+				if(bidx >= NIndex)
+					return nullptr;
+				MBlk* blk = _mbIndex[bidx];
+				// フリーリストがあるか？
+				if(blk)
+					return lt==LT_Default ? _useMB(bidx) : _useHint(bidx, s, lt);
+				// 容量以上のクラスをL1,L0の順に探索
+				int nbI = _bt.findFrom(bidx);
+				if(nbI < 0)
+					return nullptr;
+				return _useHint(nbI, s, lt);
+			}
 		public:
 			static MBlk* _ptrToBlock(void* p) {
 				return reinterpret_cast<MBlk*>((intptr_t)p - sizeof(MBlk));
@@ -294,6 +657,7 @@ namespace rs {
 			}
 
 			// ソースメモリはNMemBitの容量を与える
+			// (srcがプライベートな匿名メモリならsetPurgeZeroFill(true)でacquireZeroのmemsetを省ける)
 			TLSF(void* src, size_t sz) {
 				_src = src;
 				_sz_src = sz;
@@ -310,19 +674,29 @@ namespace rs {
 				// MBlockインデックスの初期化
 				memset(_mbIndex, 0, sizeof(_mbIndex));
 				// :BitTable L0,L1
-				_btL0 = 0;
-				for(int i=0 ; i<NDiv0 ; i++)
-					_btL1[i] = 0;
+				_bt.clear();
+
+				// :QuickList
+				_quick = nullptr;
+				_sz_quick = 0;
+				_sz_qBudget = 0;
+				_nqBatch = 0;
+				_walkCur = nullptr;
+				_bPurgeZero = false;
 
 				// 最初のブロックを追加
 				_sz_remain = 0;
 				_pushMB(r_src, r_sz);
+				_sz_init = _sz_remain;
+			}
+			~TLSF() {
+				delete _quick;
 			}
 			virtual void destroy() {
 				delete this;
 			}
-			// 確保メモリサイズの変更
-			void* reacquire(void* p, size_t s) {
+			// 確保メモリサイズの変更 (タグ集計は呼び出し側で行う)
+			void* _reacquire(void* p, size_t s) {
 				s = std::max(s, LowBlockSize());
 
 				// 現在のサイズより小さいか？
@@ -341,7 +715,9 @@ namespace rs {
 							blk->adjustPayloadSize(s);
 							blk->header()->bidx = _calcIndex(s);
 							// 空いた分を後続ブロックに加える
+							MBlk* oblk = nblk;
 							nblk = nblk->appendPrevMem(pls_s);
+							_onMerge(oblk, nblk);
 							// NBを改めてフリーリストへ加える
 							_pushMB(nblk, nblk->getBlockSize());
 						} else {
@@ -370,6 +746,7 @@ namespace rs {
 							// フリーリストから外す
 							_remBlock(nblk, false);
 							// ブロックを結合
+							_onMerge(nblk, blk);
 							blk->combineNext();
 							_useDivMB(blk, s);
 
@@ -383,68 +760,209 @@ namespace rs {
 					}
 
 					// 新しくブロックを確保してコピー
-					void* np = acquire(s);
+					void* np = _acquire(s);
 					// もし新しく領域を確保できなかったらnullを返す
 					if(!np)
 						return nullptr;
 
 					memcpy(np, p, std::min(cur_s,s));
-					release(p);
+					_release(p);
 					return np;
 				}
 				return p;
 			}
 
-			void* acquire(size_t s) {
+			// (クイックリストのブロックは置き場所を選べないので寿命ヒント付きでは使わない)
+			void* _acquire(size_t s, TLSFLifetime lt=LT_Default) {
 				s = std::max(s, LowBlockSize());
-				if(s > getRemainMem()) {
+				void* ret = nullptr;
+				if(_sz_qBudget > 0 && lt == LT_Default)
+					ret = _useQuick(s);
+				if(!ret && !(ret = _acquireMB(s, lt)) && _sz_quick > 0) {
+					// フリーリストが尽きたら一定数だけ結合してリトライ
+					_flushQuick(_nqBatch);
+					if(!(ret = _acquireMB(s, lt)) && _sz_quick > 0) {
+						// それでも無ければメモリ不足とする前に全て結合して1度だけリトライ
+						// (この場合に限り結合数はnBatch個を超える)
+						flushDeferred();
+						ret = _acquireMB(s, lt);
+					}
+				}
+				if(!ret) {
 					if(BExc)
 						throw std::bad_alloc();
 					return nullptr;
 				}
-
-				BIndex bidx = _calcIndex(s)+1;
-				void* ret = nullptr;
-				MBlk* blk = _mbIndex[bidx];
-				// フリーリストがあるか？
-				if(blk)
-					ret = _useMB(bidx);
-				else {
-					// L1探索
-					uint32_t bt = _btL1[bidx.L0Bit()];
-					L_ASSERT(bidx.L0Bit()<NDiv0, u8"");
-					// 容量以上のフラグが立っていればそれを使う
-					uint32_t t_mask = ~((1<<bidx.L1Bit()) - 1);
-					bt &= t_mask;
-					if(bt != 0) {
-						// L1に空きが見つかった
-						BIndex nbI = (bidx.value&L1MASKINV) + Bit::MSB_N(bt);
-						ret = _useDivMB(nbI, s);
-					} else {
-						// L0探索
-						// 容量未満のフラグをマスク (L1には無かった結果なので1ビットずらす)
-						t_mask = ~((2<<bidx.L0Bit())-1);
-						bt = _btL0 & t_mask;
-						if(bt != 0) {
-							// L0に空きが見つかった
-							int nbL0 = Bit::MSB_N(bt);
-							// L1探索
-							int nbL1 = Bit::MSB_N(_btL1[nbL0]);
-							int nbI = (nbL0<<NBit1) | nbL1;
-							ret = _useDivMB(nbI, s);
-						}
-						if(!ret) {
-							if(BExc)
-								throw std::bad_alloc();
-							return ret;
-						}
-					}
-				}
 	#ifdef TLSF_MEMFILL
 				memset(ret, 0xac, s);
 	#endif
 				return ret;
 			}
+			void* acquire(size_t s) {
+				return acquire(s, 0);
+			}
+			// タグ付きで確保 (tag < TLSFTag::NTag)
+			// lt: 寿命ヒント (長寿命は領域の先頭側，短寿命は末尾側に置く)
+			void* acquire(size_t s, int tag, TLSFLifetime lt=LT_Default) {
+				L_ASSERT(tag>=0 && tag<TLSFTag::NTag, u8"不正なタグ");
+				if(!_tag.check(tag, s, _tag.isHard(tag) ? GetMaxPayload(s) : 0)) {
+					if(BExc)
+						throw std::bad_alloc();
+					return nullptr;
+				}
+				void* ret = _acquire(s, lt);
+				if(ret) {
+					MBlk* blk = _ptrToBlock(ret);
+					blk->setTag(tag);
+					_tag.add(tag, blk->getPayloadSize());
+				}
+				return ret;
+			}
+			void* reacquire(void* p, size_t s) {
+				MBlk* blk = _ptrToBlock(p);
+				int tag = blk->getTag();
+				size_t cur_s = blk->getPayloadSize(),
+						max_s = _tag.isHard(tag) ? GetMaxPayload(s) : 0;
+				if(!_tag.check(tag, s>cur_s ? s-cur_s : 0, max_s>cur_s ? max_s-cur_s : 0)) {
+					if(BExc)
+						throw std::bad_alloc();
+					return nullptr;
+				}
+				void* ret = _reacquire(p, s);
+				// (失敗時は元のブロックがそのまま残る)
+				if(ret) {
+					_tag.sub(tag, cur_s);
+					blk = _ptrToBlock(ret);
+					blk->setTag(tag);
+					_tag.add(tag, blk->getPayloadSize());
+				}
+				return ret;
+			}
+			// ゼロ埋めされた領域を確保
+			// (setPurgeZeroFill(true)の時は返却済みページのmemsetを省く)
+			void* acquireZero(size_t s, int tag=0, TLSFLifetime lt=LT_Default) {
+				void* ret = acquire(s, tag, lt);
+				if(!ret)
+					return ret;
+				MBlk* blk = _ptrToBlock(ret);
+	#ifdef TLSF_MEMFILL
+				memset(ret, 0, s);
+	#else
+				if(_bPurgeZero && blk->isPurged()) {
+					uintptr_t pg = GetPageSize(),
+							beg = (uintptr_t)ret,
+							end = beg + s,
+							zbeg = std::min((beg + pg-1) & ~(pg-1), end),
+							zend = std::max(end & ~(pg-1), zbeg);
+					memset(ret, 0, zbeg-beg);
+					memset((void*)zend, 0, end-zend);
+				} else
+					memset(ret, 0, s);
+	#endif
+				blk->setPurged(false);
+				return ret;
+			}
+			static size_t GetPageSize() {
+	#ifdef MSVC
+				return 4096;
+	#else
+				static const size_t pg = sysconf(_SC_PAGESIZE);
+				return pg;
+	#endif
+			}
+			// 閾値以上の空きブロックのページ内部をOSへ返却
+			// bLazy: MADV_FREEを使う (内容が残る可能性があるのでゼロ埋め扱いにはしない)
+			// (MADV_DONTNEEDでゼロ埋めされるのはプライベートな匿名メモリのみ．
+			//  共有/ファイルマップでは内容が戻るので，ゼロ埋めを当てにするならsetPurgeZeroFillで指定する)
+			// 戻り値: 新たに返却したバイト数
+			size_t purge(size_t threshold, bool bLazy=false) {
+				size_t ret = 0;
+	#ifndef MSVC
+				const uintptr_t pg = GetPageSize();
+				// 閾値以上のブロックしか入っていないクラスから上を調べる
+				for(u32 i=_calcIndex(threshold)+1 ; i<NIndex ; i++) {
+					if(!_bt.test(i))
+						continue;
+					for(MBlk* blk=_mbIndex[i] ; blk ; blk=blk->header()->pNext) {
+						if(blk->isPurged())
+							continue;
+						uintptr_t beg = ((uintptr_t)blk->payload() + pg-1) & ~(pg-1),
+								end = ((uintptr_t)blk->payload() + blk->getPayloadSize()) & ~(pg-1);
+						if(beg >= end)
+							continue;
+		#ifdef MADV_FREE
+						int advice = bLazy ? MADV_FREE : MADV_DONTNEED;
+		#else
+						int advice = MADV_DONTNEED;
+						bLazy = false;
+		#endif
+						if(madvise((void*)beg, end-beg, advice) != 0)
+							continue;
+						if(!bLazy)
+							blk->setPurged(true);
+						ret += end-beg;
+					}
+				}
+	#endif
+				return ret;
+			}
+			// 第1,2レベルのインデックスに属するペイロードの最小サイズ
+			static size_t GetClassSize(u32 bidx) {
+				int fLv = bidx >> NBit1,
+					sLv = bidx & L1MASK;
+				if(fLv == 0)
+					return size_t(sLv) << (Index::NFS-NBit1);
+				return (size_t(1) << (Index::NFS+fLv-1)) + (size_t(sLv) << (Index::NFS+fLv-1-NBit1));
+			}
+			// サイズsの確保で実際に割り当てられ得る最大のペイロード
+			// (丸め上げたクラスのブロックは分割せずに使う事があり，
+			//  分割する場合も端数がヘッダ+最小ブロック未満なら付けたままにする)
+			static size_t GetMaxPayload(size_t s) {
+				s = std::max(s, size_t(_LowBlockSize));
+				return std::max(GetClassSize(_calcIndex(s)+2), s + MBlk::GetHeaderSize() + _LowBlockSize) - 1;
+			}
+			// サイズsの確保に必要な領域サイズ (新しく作った領域で確実にacquireできる大きさ)
+			static size_t GetArenaSize(size_t s) {
+				s = std::max(s, size_t(_LowBlockSize));
+				return GetClassSize(_calcIndex(s)+1) + MBlk::GetHeaderSize()*2 + sizeof(u8);
+			}
+			// 物理順にブロックを走査しfに渡す
+			// nMax個走査した所で中断し，次の呼び出しで続きから再開する (0で最後まで)
+			// 中断中に走査位置のブロックが結合されても続きから辿れるよう位置を付け替える
+			// 戻り値: 最後まで走査したか
+			template <class F>
+			bool walk(F f, size_t nMax=0) {
+				size_t n = nMax>0 ? nMax : std::numeric_limits<size_t>::max();
+				return _walk(f, n);
+			}
+			// (nLeftは走査した分だけ減らす)
+			template <class F>
+			bool _walk(F& f, size_t& nLeft) {
+				uintptr_t endP = (uintptr_t)_src + _sz_src - 1;
+				MBlk* blk = _walkCur ? _walkCur : ((MBlk*)_src)->next();
+				while((uintptr_t)blk != endP) {
+					if(nLeft == 0) {
+						_walkCur = blk;
+						return false;
+					}
+					--nLeft;
+					TLSFBlockInfo bi;
+					bi.ptr = blk->payload();
+					bi.size = blk->getPayloadSize();
+					bi.bUse = blk->isUsing();
+					bi.bidx = blk->header()->bidx;
+					bi.l0 = bi.bidx >> NBit1;
+					bi.l1 = bi.bidx & L1MASK;
+					f(bi);
+					blk = blk->next();
+				}
+				_walkCur = nullptr;
+				return true;
+			}
+			// 中断中の走査を破棄
+			void walkReset() {
+				_walkCur = nullptr;
+			}
 			void check() {
 				intptr_t endP = (intptr_t)_src + _sz_src - 1;
 				MBlk* blk = (MBlk*)_src;
@@ -477,39 +995,103 @@ namespace rs {
 			}
 
 			void release(void* ptr) {
+				MBlk* blk = _ptrToBlock(ptr);
+				_tag.sub(blk->getTag(), blk->getPayloadSize());
+				_release(ptr);
+			}
+			void _release(void* ptr) {
 				MBlk* blk = _ptrToBlock(ptr);
 				L_ASSERT(blk->isUsing(), u8"管轄外メモリが渡された");
 	#ifdef TLSF_MEMFILL
 				memset(ptr, 0xfc, blk->getPayloadSize());
 	#endif
+				if(_sz_qBudget >= blk->getPayloadSize()) {
+					// 上限を超えるなら先に一定数を結合しておく
+					if(_sz_quick + blk->getPayloadSize() > _sz_qBudget)
+						_flushQuick(_nqBatch);
+					if(_sz_quick + blk->getPayloadSize() <= _sz_qBudget) {
+						_pushQuick(blk);
+						return;
+					}
+				}
 				// 前後のブロックと結合を試みる
-				if(blk->canCombinePrev()) {
-					MBlk* bptr = blk->prev();
-					_remBlock(bptr, false);
-					blk->combinePrev();
-
-					bptr->header()->bidx = _calcIndex(bptr->getPayloadSize());
-					blk = bptr;
+				_releaseMB(blk);
+			}
+			// ソースメモリがプライベートな匿名メモリで，返却済みページがゼロ埋めされる事を指定
+			void setPurgeZeroFill(bool b) {
+				_bPurgeZero = b;
+			}
+			// 遅延結合モードの設定
+			// budget: クイックリストに保持する最大バイト数 (0で無効化)
+			// nBatch: 一度に結合処理するブロック数の上限 (最悪実行時間を決める)
+			// (確保時もnBatch個の結合で足りなければ全て結合するので，その1回だけは上限を超える)
+			void setDeferredCoalesce(size_t budget, int nBatch) {
+				if(budget > 0 && !_quick) {
+					_quick = new QuickList;
+					memset(_quick->index, 0, sizeof(_quick->index));
+					_quick->bt.clear();
 				}
-				if(blk->canCombineNext()) {
-					_remBlock(blk->next(), false);
-					blk->combineNext();
-
-					blk->header()->bidx = _calcIndex(blk->getPayloadSize());
+				_sz_qBudget = budget;
+				_nqBatch = std::max(nBatch, 1);
+				while(_sz_quick > _sz_qBudget)
+					_flushQuick(_nqBatch);
+				if(budget == 0) {
+					delete _quick;
+					_quick = nullptr;
 				}
-
-				_pushMB(blk, blk->getBlockSize());
 			}
+			// クイックリストのブロックを全て結合
+			void flushDeferred() {
+				while(_sz_quick > 0)
+					_flushQuick(_nqBatch);
+			}
+			size_t getDeferredMem() const {
+				return _sz_quick;
+			}
+			// (クイックリスト上のブロックも空き容量に含める)
 			size_t getRemainMem() const {
-				return _sz_remain;
+				return _sz_remain + _sz_quick;
+			}
+			// 全てのブロックが解放・結合済みか
+			bool isEmpty() const {
+				return _sz_quick == 0 && _sz_remain == _sz_init;
 			}
 			size_t getSegmentSize(void* p) const {
 				MBlk* blk = _ptrToBlock(p);
 				return blk->getPayloadSize();
 			}
+			int getTag(void* p) const {
+				return _ptrToBlock(p)->getTag();
+			}
+			// タグ別の使用量と上限
+			TLSFTag& tagTable() {
+				return _tag;
+			}
+			const TLSFTag& tagTable() const {
+				return _tag;
+			}
 
 			// ランダムなサイズで確保，解放，サイズ変更を繰り返しテスト
 			void unit_test(int n) {
+				// 早見表と計算結果が一致するか
+				for(size_t s=0 ; s<Index::LUT_LIMIT ; s++) {
+					if(_calcIndex(s) != _calcIndexBit(s))
+						__asm__("int 3");
+				}
+				// ビット位置 (組み込み関数版と表引き版)
+				for(u32 i=0 ; i<32 ; i++) {
+					const u32 b = u32(1) << i;
+					if(Bit::MSB_N(b) != i || Bit::MSB_N(b|1) != i || Bit::LSB_N(b) != i || Bit::LSB_N(~u32(0)<<i) != i ||
+						Bit::MSB_T(b) != i || Bit::MSB_T(b|1) != i || Bit::LSB_T(b) != i || Bit::LSB_T(~u32(0)<<i) != i)
+						__asm__("int 3");
+				}
+				for(u32 i=0 ; i<64 ; i++) {
+					const u64 b = u64(1) << i;
+					if(Bit::MSB_N(b) != i || Bit::MSB_N(b|1) != i || Bit::LSB_N(b) != i || Bit::LSB_N(~u64(0)<<i) != i ||
+						Bit::MSB_T(b) != i || Bit::MSB_T(b|1) != i || Bit::LSB_T(b) != i || Bit::LSB_T(~u64(0)<<i) != i)
+						__asm__("int 3");
+				}
+
 				const int N_ITER = 256;
 				const int modsize = _sz_src / (N_ITER*2);
 				for(int i=0 ; i<n ; i++) {
@@ -536,6 +1118,9 @@ namespace rs {
 					check();
 				}
 			}
+			uintptr_t getBeginPtr() const {
+				return (uintptr_t)_src;
+			}
 			uintptr_t getEndPtr() const {
 				return (uintptr_t)_src + _sz_src;
 			}
@@ -552,7 +1137,7 @@ namespace rs {
 			void* acquire(size_t s) { return malloc(s); }
 			void* reacquire(void* p, size_t s) { return realloc(p, s); }
 			void release(void* p) { free(p); }
-			size_t getRemainMem() const { return (size_t)std::numeric_limits<size_t>::max; }
+			size_t getRemainMem() const { return std::numeric_limits<size_t>::max(); }
 			size_t getSegmentSize(void* p) const { return 0; }
 			size_t LowFLevelSize() const { return 0; }
 			size_t LowBlockSize() const { return 0; }
@@ -568,91 +1153,232 @@ namespace rs {
 			const static size_t MAXSIZE = (1<<NMemBit)-1;
 
 			TLSFNew(size_t sz=size_t(1<<NMemBit)-1):
-				_TLSF(_pBuff=new u8[std::min(sz,size_t(1<<NMemBit)-1)], std::min(sz,size_t(1<<NMemBit)-1)) {}
+				_TLSF(_pBuff=new u8[std::min(sz,size_t(1<<NMemBit)-1)], std::min(sz,size_t(1<<NMemBit)-1))
+			{
+				// (new[]の領域はプライベートな匿名メモリ)
+				_TLSF::setPurgeZeroFill(true);
+			}
 			virtual void destroy() {
 				delete[] _pBuff;
 				_TLSF::destroy();
 			}
 	};
 
-	// 複数の内部TLSFアロケータを持ち，必要に応じて一定量ずつ追加でメモリ領域を確保
-	// (今の所解放はしない)
+	// TLSFBlockの領域追加ポリシー
+	// (szNeed: 要求を満たすのに必要な最小サイズ, szTotal: 確保済み領域の合計, nAlc: 領域数)
+	// 戻り値: 追加する領域のサイズ (szNeed未満なら追加しない)
+	struct TLSFGrow {
+		typedef std::function<size_t (size_t, size_t, int)>	Policy;
+
+		// 一定サイズずつ
+		static Policy Fixed(size_t sz) {
+			return [sz](size_t szNeed, size_t, int) {
+				return std::max(sz, szNeed);
+			};
+		}
+		// 領域を追加する毎にratio倍
+		static Policy Geometric(size_t szBase, double ratio) {
+			return [szBase, ratio](size_t szNeed, size_t, int nAlc) {
+				double sz = szBase;
+				for(int i=0 ; i<nAlc ; i++)
+					sz *= ratio;
+				return std::max(size_t(std::min(sz, double(std::numeric_limits<size_t>::max()/2))), szNeed);
+			};
+		}
+		// 要求に合わせる (最低szMin)
+		static Policy Fit(size_t szMin) {
+			return [szMin](size_t szNeed, size_t, int) {
+				return std::max(szMin, szNeed);
+			};
+		}
+		// 合計がszBudgetを超えないよう制限
+		static Policy Capped(const Policy& p, size_t szBudget) {
+			return [p, szBudget](size_t szNeed, size_t szTotal, int nAlc) -> size_t {
+				if(szTotal >= szBudget)
+					return 0;
+				return std::min(p(szNeed, szTotal, nAlc), szBudget-szTotal);
+			};
+		}
+	};
+
+	// 複数の内部TLSFアロケータを持ち，必要に応じてポリシーに従って追加でメモリ領域を確保
+	// (短寿命専用の領域は空になった時点で削除する．それ以外の領域は解放しない)
 	template <int NMemBit, int NBit0, int NBit1>
 	class TLSFBlock : public ImplTLSF {
 		private:
 			const static size_t MAXSIZE = (1<<NMemBit)-1;
 			typedef TLSFNew<NMemBit,NBit0,NBit1,false>	_TLSF;
 
-			const size_t	_szBlock;
 			_TLSF*			_top;
-			// TLSFアロケータリスト(トップのクラス内に確保)
-			typedef std::pair<uintptr_t, _TLSF*>	TLSPair;	// ポインタ範囲(End)
+			// TLSFアロケータリスト
+			// (領域内に置くと最初の領域が埋まった時に拡張できなくなるので別に確保する)
+			struct TLSPair {
+				uintptr_t	first;		// ポインタ範囲(End)
+				_TLSF*		second;
+				bool		bShort;		// 短寿命専用の領域か
+
+				TLSPair(): first(0), second(nullptr), bShort(false) {}
+				TLSPair(uintptr_t e, _TLSF* t, bool bS=false): first(e), second(t), bShort(bS) {}
+			};
 			TLSPair*		_alcList;
 			int				_nAlc, _szAlc;
+			// タグ別の使用量と上限 (全アロケータの合計)
+			TLSFTag			_tag;
+			// 分割走査中のアロケータ番号
+			int				_walkAlc;
+			// 領域の合計サイズ
+			size_t			_szTotal;
+			TLSFGrow::Policy	_grow;
+			// メモリ不足時のハンドラ (trueを返すと確保を再試行)
+			typedef std::function<bool (size_t)>	OOMHandler;
+			OOMHandler		_oom;
 
-			_TLSF* _addNewBlock() {
+			// szNeed以上の領域を追加 (ポリシーが拒否すればnullptr)
+			_TLSF* _addNewBlock(size_t szNeed, bool bShort=false) {
+				size_t sz = std::min(_grow(szNeed, _szTotal, _nAlc), size_t(MAXSIZE));
+				if(sz < szNeed)
+					return nullptr;
 				// アロケータリストが足りるか
 				if(_szAlc-1 == _nAlc) {
 					// 2倍に拡張
+					TLSPair* np = new(std::nothrow) TLSPair[_szAlc*2];
+					if(!np)
+						return nullptr;
+					std::copy(_alcList, _alcList+_nAlc, np);
+					delete[] _alcList;
+					_alcList = np;
 					_szAlc *= 2;
-					_top->reacquire(_alcList, sizeof(TLSPair)*_szAlc);
 				}
-				_TLSF* m = new _TLSF(_szBlock);
-				_alcList[_nAlc++] = TLSPair(m->getEndPtr(), m);
+				_TLSF* m = new _TLSF(sz);
+				_alcList[_nAlc++] = TLSPair(m->getEndPtr(), m, bShort);
+				_szTotal += sz;
 				return m;
 			}
+			// 空になった短寿命領域を削除 (他に短寿命領域が残っている場合のみ)
+			void _drainShort(int idx) {
+				if(!_alcList[idx].bShort || !_alcList[idx].second->isEmpty())
+					return;
+				int nShort = 0;
+				for(int i=0 ; i<_nAlc ; i++)
+					nShort += _alcList[i].bShort ? 1 : 0;
+				if(nShort < 2)
+					return;
+				_TLSF* tls = _alcList[idx].second;
+				_szTotal -= tls->getEndPtr() - tls->getBeginPtr();
+				tls->destroy();
+				for(int i=idx+1 ; i<_nAlc ; i++)
+					_alcList[i-1] = _alcList[i];
+				--_nAlc;
+				// 走査中の位置を合わせる
+				if(_walkAlc > idx)
+					--_walkAlc;
+			}
+			// pを解放し，短寿命領域が空になれば削除
+			void _releaseAt(int idx, void* p) {
+				_alcList[idx].second->release(p);
+				_drainShort(idx);
+			}
+			// (各アロケータの領域はアドレス順とは限らないので範囲の両端を調べる)
 			int _witchMem(void* p) const {
-				for(int i=0 ; i<_nAlc-1 ; i++)
-					if((uintptr_t)p < _alcList[i].first)
+				for(int i=0 ; i<_nAlc ; i++) {
+					if((uintptr_t)p < _alcList[i].first &&
+						(uintptr_t)p >= _alcList[i].second->getBeginPtr())
 						return i;
-				return _nAlc-1;
+				}
+				return -1;
+			}
+			// リストの上から順番に確保を試み，無ければ新しいブロックを追加
+			// 領域を追加しても確保できなければメモリ不足ハンドラを呼んで再試行する
+			// (短寿命の確保は短寿命専用の領域のみ，それ以外は通常の領域のみを使う)
+			void* _acquire(size_t s, int tag, bool bZero, TLSFLifetime lt, _TLSF** ppTls) {
+				if(s > MAXSIZE || _TLSF::GetArenaSize(s) > MAXSIZE)
+					throw std::bad_alloc();
+				const bool bShort = lt==LT_Short;
+				do {
+					void* ret;
+					for(int i=0 ; i<_nAlc ; i++) {
+						if(_alcList[i].bShort != bShort)
+							continue;
+						_TLSF* tls = _alcList[i].second;
+						if(ret = bZero ? tls->acquireZero(s, tag, lt) : tls->acquire(s, tag, lt)) {
+							*ppTls = tls;
+							return ret;
+						}
+					}
+					if(_TLSF* tls = _addNewBlock(_TLSF::GetArenaSize(s), bShort)) {
+						*ppTls = tls;
+						return bZero ? tls->acquireZero(s, tag, lt) : tls->acquire(s, tag, lt);
+					}
+				} while(_oom && _oom(s));
+				return nullptr;
+			}
+			void* _acquireTag(size_t s, int tag, bool bZero, TLSFLifetime lt) {
+				// 上限の判定はブロックを追加する前に行う
+				if(!_tag.check(tag, s, _tag.isHard(tag) ? _TLSF::GetMaxPayload(s) : 0))
+					return nullptr;
+				_TLSF* tls;
+				void* ret = _acquire(s, tag, bZero, lt, &tls);
+				if(ret)
+					_tag.add(tag, tls->getSegmentSize(ret));
+				return ret;
 			}
 		public:
-			// 追加ブロック容量を設定
-			TLSFBlock(size_t sz=MAXSIZE): _szBlock(sz), _top(new _TLSF(sz)) {
-				_alcList = (TLSPair*)_top->acquire(sizeof(TLSPair)*4);
-				memset(_alcList, 0, sizeof(TLSPair)*4);
+			// sz: 最初の領域の容量 (既定の追加ポリシーTLSFGrow::Fixedもこの容量ずつ追加する)
+			TLSFBlock(size_t sz=MAXSIZE): _top(new _TLSF(sz)), _szTotal(sz), _grow(TLSFGrow::Fixed(sz)) {
+				_alcList = new TLSPair[4];
 				_alcList[0] = TLSPair(_top->getEndPtr(), _top);
 				_szAlc = 4;
 				_nAlc = 1;
+				_walkAlc = 0;
 			}
 			virtual void destroy() {
-				// (topのTLSFはリストを含んでいる為，最後にする)
-				for(int i=1 ; i<_nAlc ; i++)
-					delete _alcList[i].second;
-				_top->release(_alcList);
-				delete _top;
+				for(int i=0 ; i<_nAlc ; i++)
+					_alcList[i].second->destroy();
+				delete[] _alcList;
 				delete this;
 			}
 
-			 void* acquire(size_t s) {
-				if(_szBlock-_TLSF::GetPaddingSize() < s)
-					throw std::bad_alloc();
-				void* ret;
-				// リストの上から順番に確保を試みる
-				for(int i=0 ; i<_nAlc ; i++) {
-					if(ret = _alcList[i].second->acquire(s))
-						return ret;
-				}
-				// 新しいブロックを追加
-				_TLSF* tls = _addNewBlock();
-				return tls->acquire(s);
+			void* acquire(size_t s) {
+				return _acquireTag(s, 0, false, LT_Default);
+			}
+			// タグ付きで確保 (上限を超える場合はnullptr)
+			// lt: 寿命ヒント (LT_Shortは短寿命専用の領域に分けて置き，空になった領域は削除する)
+			void* acquire(size_t s, int tag, TLSFLifetime lt=LT_Default) {
+				return _acquireTag(s, tag, false, lt);
+			}
+			// pがいずれかの内部アロケータの管轄か
+			bool hasPointer(void* p) const {
+				return _witchMem(p) >= 0;
 			}
 			void release(void* p) {
 				// 範囲チェックによりどのクラスの物か特定
-				_alcList[_witchMem(p)].second->release(p);
+				int idx = _witchMem(p);
+				auto* pTls = _alcList[idx].second;
+				_tag.sub(pTls->getTag(p), pTls->getSegmentSize(p));
+				_releaseAt(_witchMem(p), p);
 			}
 			void* reacquire(void* p, size_t s) {
 				// サイズが大きくなる場合，同じアロケータでは確保できない可能性がある
-				auto* pTls = _alcList[_witchMem(p)].second;
+				int idx = _witchMem(p);
+				auto* pTls = _alcList[idx].second;
+				int tag = pTls->getTag(p);
+				size_t cur_s = pTls->getSegmentSize(p),
+						max_s = _tag.isHard(tag) ? _TLSF::GetMaxPayload(s) : 0;
+				if(!_tag.check(tag, s>cur_s ? s-cur_s : 0, max_s>cur_s ? max_s-cur_s : 0))
+					return nullptr;
+				_TLSF* nTls = pTls;
 				void* ret = pTls->reacquire(p, s);
 				if(!ret) {
-					// 別アロケータから確保し，コピー
-					ret = acquire(s);
-					auto* blk = pTls->_ptrToBlock(p);
-					memcpy(ret, blk->payload(), blk->getPayloadSize());
-					release(p);
+					// 別アロケータから確保し，コピー (元の領域と同じ寿命で置く)
+					TLSFLifetime lt = _alcList[idx].bShort ? LT_Short : LT_Default;
+					if(!(ret = _acquire(s, tag, false, lt, &nTls)))
+						return nullptr;
+					memcpy(ret, p, cur_s);
+					// (メモリ不足ハンドラ内の解放で短寿命領域が削除されリストがずれる事があるので引き直す)
+					_releaseAt(_witchMem(p), p);
 				}
+				_tag.sub(tag, cur_s);
+				_tag.add(tag, nTls->getSegmentSize(ret));
 				return ret;
 			}
 			size_t getRemainMem() const {
@@ -664,6 +1390,72 @@ namespace rs {
 			size_t getSegmentSize(void* p) const {
 				return _alcList[_witchMem(p)].second->getSegmentSize(p);
 			}
+			void* acquireZero(size_t s, int tag=0, TLSFLifetime lt=LT_Default) {
+				return _acquireTag(s, tag, true, lt);
+			}
+			int getTag(void* p) const {
+				return _alcList[_witchMem(p)].second->getTag(p);
+			}
+			// 領域追加ポリシーを設定 (既定はTLSFGrow::Fixed(コンストラクタで指定した容量))
+			void setGrowPolicy(const TLSFGrow::Policy& p) {
+				_grow = p;
+			}
+			// メモリ不足時のハンドラを設定
+			// (キャッシュの解放等をしてtrueを返すと確保を再試行する．falseで諦める)
+			void setOOMHandler(const OOMHandler& h) {
+				_oom = h;
+			}
+			// 空き容量がbytes以上になるまで前もって領域を追加
+			// 戻り値: 確保できたか
+			bool reserve(size_t bytes) {
+				size_t remain;
+				while((remain = getRemainMem()) < bytes) {
+					if(!_addNewBlock(std::min(bytes-remain + _TLSF::GetArenaSize(0), size_t(MAXSIZE))))
+						return false;
+				}
+				return true;
+			}
+			// 確保済み領域の合計サイズ
+			size_t getTotalMem() const {
+				return _szTotal;
+			}
+			// 内部アロケータの数
+			int getArenaCount() const {
+				return _nAlc;
+			}
+			// タグ別の使用量と上限
+			TLSFTag& tagTable() {
+				return _tag;
+			}
+			const TLSFTag& tagTable() const {
+				return _tag;
+			}
+			static size_t GetClassSize(u32 bidx) {
+				return _TLSF::GetClassSize(bidx);
+			}
+			// 全てのアロケータを順に走査 (nMax個で中断，次の呼び出しで再開)
+			template <class F>
+			bool walk(F f, size_t nMax=0) {
+				size_t n = nMax>0 ? nMax : std::numeric_limits<size_t>::max();
+				for( ; _walkAlc<_nAlc ; _walkAlc++) {
+					if(!_alcList[_walkAlc].second->_walk(f, n))
+						return false;
+				}
+				_walkAlc = 0;
+				return true;
+			}
+			void walkReset() {
+				for(int i=0 ; i<_nAlc ; i++)
+					_alcList[i].second->walkReset();
+				_walkAlc = 0;
+			}
+			// 全てのアロケータについて空きページを返却
+			size_t purge(size_t threshold, bool bLazy=false) {
+				size_t count = 0;
+				for(int i=0 ; i<_nAlc ; i++)
+					count += _alcList[i].second->purge(threshold, bLazy);
+				return count;
+			}
 			size_t LowFLevelSize() const {
 				return _top->LowFLevelSize();
 			}
@@ -671,4 +1463,28 @@ namespace rs {
 				return _top->LowBlockSize();
 			}
 	};
+
+	// 最小ブロックサイズ，最大領域サイズ，内部損失の上限(%)からテンプレート引数を導出
+	// (例: TLSFParam<16, (1<<24)-1, 7>::Alloc<true>::type)
+	template <size_t MinBlock, size_t MaxSize, int WastePct>
+	struct TLSFParam {
+		static_assert(MinBlock > 0 && WastePct > 0 && WastePct <= 100, "パラメータが範囲外");
+		// 領域サイズはNMemBitで表せる範囲 (1<<NMemBit)-1 まで
+		const static int NMemBit = Bit::CeilLog2(u64(MaxSize)+1),
+						// 等分割による損失は最大 1/(1<<NBit1)
+						NBit1 = Bit::CeilLog2((100 + WastePct-1) / WastePct) > 0 ?
+									Bit::CeilLog2((100 + WastePct-1) / WastePct) : 1,
+						// 最小ブロックサイズまで分割するのに必要な第1レベルの段数
+						NLevel = NMemBit + 1 - NBit1 - (int)Bit::MSB_C(MinBlock),
+						NBit0 = Bit::CeilLog2(NLevel > 2 ? NLevel : 2);
+		static_assert(NBit1 <= 8, "内部損失の上限が小さすぎる (NBit1 <= 8)");
+		static_assert(NBit0 <= 5, "最小ブロックサイズが小さすぎる (NBit0 <= 5)");
+		static_assert(NMemBit <= 30, "最大領域サイズが大きすぎる");
+
+		template <bool BExc>
+		struct Alloc {
+			typedef TLSF<NMemBit, NBit0, NBit1, BExc>	type;
+		};
+		typedef TLSFBlock<NMemBit, NBit0, NBit1>	Block;
+	};
 }
\ No newline at end of file
@@ -0,0 +1,137 @@
+#pragma once
+#include "tlsf.h"
+#include <vector>
+#include <ostream>
+
+namespace rs {
+	// ロック不要な場合に使うダミー
+	struct TLSFNullLock {
+		void lock() {}
+		void unlock() {}
+	};
+
+	// ヒープの使用状況と空きブロックの分布
+	struct TLSFHeapStat {
+		struct Class {
+			u32		l0, l1;
+			size_t	nFree, szFree;
+		};
+		// 空きブロックのクラス(bidx)別集計
+		std::vector<Class>	cls;
+		size_t	nBlock,
+				nUse, szUse,
+				nFree, szFree,
+				// 最大の空きブロック
+				szLargest,
+				// 実際に1回のacquireで確保できる最大サイズ
+				// (acquireはbidx+1以上のクラスから探すので最大の空きブロックより小さくなる)
+				szFit;
+
+		TLSFHeapStat(): nBlock(0), nUse(0), szUse(0), nFree(0), szFree(0), szLargest(0), szFit(0) {}
+		template <class T>
+		void add(const TLSFBlockInfo& bi) {
+			++nBlock;
+			if(bi.bUse) {
+				++nUse;
+				szUse += bi.size;
+				return;
+			}
+			++nFree;
+			szFree += bi.size;
+			szLargest = std::max(szLargest, bi.size);
+			size_t szCls = T::GetClassSize(bi.bidx);
+			if(szCls > 0)
+				szFit = std::max(szFit, std::min(bi.size, szCls-1));
+			if(cls.size() <= bi.bidx)
+				cls.resize(bi.bidx+1, Class{0,0,0,0});
+			Class& c = cls[bi.bidx];
+			c.l0 = bi.l0;
+			c.l1 = bi.l1;
+			++c.nFree;
+			c.szFree += bi.size;
+		}
+		// 空き容量に対する外部断片化率 (1 - 確保可能最大 / 空き合計)
+		double fragmentation() const {
+			return szFree==0 ? 0.0 : 1.0 - double(szFit)/double(szFree);
+		}
+	};
+
+	// ヒープを走査して統計を取る
+	// nSlice個のブロック毎にロックを解放し，その間は他スレッドが確保/解放できる
+	// (走査中にヒープが変化するので厳密なスナップショットではない)
+	template <class T, class L>
+	void CollectHeapStat(T& alc, L& lk, TLSFHeapStat& st, size_t nSlice=256) {
+		bool bDone;
+		do {
+			lk.lock();
+			bDone = alc.walk([&st](const TLSFBlockInfo& bi) { st.template add<T>(bi); }, nSlice);
+			lk.unlock();
+		} while(!bDone);
+	}
+	template <class T>
+	TLSFHeapStat CollectHeapStat(T& alc) {
+		TLSFNullLock lk;
+		TLSFHeapStat st;
+		CollectHeapStat(alc, lk, st, 0);
+		return st;
+	}
+
+	// 領域マップをJSONで出力
+	// {"blocks":[[addr,size,used,bidx],...],"classes":[[l0,l1,count,bytes],...],
+	//  "remain":N,"free":N,"largest":N,"fit":N}
+	template <class T, class L>
+	void DumpHeapJSON(T& alc, L& lk, std::ostream& os, size_t nSlice=256) {
+		TLSFHeapStat st;
+		bool bFirst = true,
+			bDone;
+		os << "{\"blocks\":[";
+		do {
+			lk.lock();
+			bDone = alc.walk([&](const TLSFBlockInfo& bi) {
+				st.template add<T>(bi);
+				os << (bFirst ? "[" : ",[") << (uintptr_t)bi.ptr << ',' << bi.size << ','
+					<< (bi.bUse ? 1 : 0) << ',' << bi.bidx << ']';
+				bFirst = false;
+			}, nSlice);
+			lk.unlock();
+		} while(!bDone);
+		os << "],\"classes\":[";
+		bFirst = true;
+		for(auto& c : st.cls) {
+			if(c.nFree == 0)
+				continue;
+			os << (bFirst ? "[" : ",[") << c.l0 << ',' << c.l1 << ',' << c.nFree << ',' << c.szFree << ']';
+			bFirst = false;
+		}
+		lk.lock();
+		size_t remain = alc.getRemainMem();
+		lk.unlock();
+		os << "],\"remain\":" << remain << ",\"free\":" << st.szFree
+			<< ",\"largest\":" << st.szLargest << ",\"fit\":" << st.szFit << "}";
+	}
+
+	// 領域マップをバイナリで出力
+	// ヘッダ "TLSFMAP1" に続き，ブロック毎に
+	// u64 アドレス, u64 サイズ, u8 使用中, u8 予備, u16 bidx (ホストのバイトオーダー)
+	template <class T, class L>
+	void DumpHeapBinary(T& alc, L& lk, std::ostream& os, size_t nSlice=256) {
+		os.write("TLSFMAP1", 8);
+		bool bDone;
+		do {
+			lk.lock();
+			bDone = alc.walk([&os](const TLSFBlockInfo& bi) {
+				u8 rec[20];
+				u64 addr = (uintptr_t)bi.ptr,
+					size = bi.size;
+				u16 bidx = bi.bidx;
+				memcpy(rec, &addr, 8);
+				memcpy(rec+8, &size, 8);
+				rec[16] = bi.bUse ? 1 : 0;
+				rec[17] = 0;
+				memcpy(rec+18, &bidx, 2);
+				os.write((const char*)rec, sizeof(rec));
+			}, nSlice);
+			lk.unlock();
+		} while(!bDone);
+	}
+}
@@ -0,0 +1,279 @@
+#pragma once
+#include "tlsf.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rs {
+	// スレッドセーフなTLSFBlock
+	// 内部アロケータ(アリーナ)毎にスピンロックを持ち，
+	// 確保はスレッド毎の優先アリーナから順にtry-lockで試す．
+	// 全て競合していた場合は上限数まで新しいアリーナを追加して逃がす．
+	// アリーナ配列は追加のみで公開後は書き換えないので，解放時の検索はロック無しで行える
+	template <int NMemBit, int NBit0, int NBit1>
+	class TLSFBlockMT : public ImplTLSF {
+		private:
+			const static size_t MAXSIZE = (1<<NMemBit)-1;
+			const static int MAX_ARENA = 256;
+			typedef TLSFNew<NMemBit,NBit0,NBit1,false>	_TLSF;
+
+			struct alignas(64) Arena {
+				std::atomic_flag	flag;
+				_TLSF*				tlsf;
+				uintptr_t			begin, end;
+
+				// (C++17より前のnewはアラインメントを保証しないので自前で揃える)
+				static void* operator new(size_t sz) {
+					void* raw = ::operator new(sz + 64);
+					void* p = (void*)(((uintptr_t)raw + 64) & ~uintptr_t(63));
+					((void**)p)[-1] = raw;
+					return p;
+				}
+				static void operator delete(void* p) {
+					::operator delete(((void**)p)[-1]);
+				}
+				Arena(size_t sz): tlsf(new _TLSF(sz)) {
+					flag.clear();
+					begin = tlsf->getBeginPtr();
+					end = tlsf->getEndPtr();
+				}
+				~Arena() {
+					tlsf->destroy();
+				}
+				bool tryLock() {
+					return !flag.test_and_set(std::memory_order_acquire);
+				}
+				void lock() {
+					while(flag.test_and_set(std::memory_order_acquire))
+						std::this_thread::yield();
+				}
+				void unlock() {
+					flag.clear(std::memory_order_release);
+				}
+				bool has(void* p) const {
+					return (uintptr_t)p >= begin && (uintptr_t)p < end;
+				}
+			};
+
+			const size_t		_szBlock;
+			// 競合を理由にアリーナを追加してよい上限数
+			const int			_nSpill;
+			std::atomic<Arena*>	_arena[MAX_ARENA];
+			std::atomic<int>	_nArena;
+			// アリーナ追加時のみ使用
+			std::mutex			_mtxGrow;
+
+			// スレッド毎の優先アリーナ番号
+			static int& _Pref() {
+				static std::atomic<int> s_count(0);
+				static thread_local int t_pref = -1;
+				if(t_pref < 0)
+					t_pref = s_count++;
+				return t_pref;
+			}
+			Arena* _at(int idx) const {
+				return _arena[idx].load(std::memory_order_acquire);
+			}
+			// pを管轄するアリーナ (ロック無し)
+			Arena* _find(void* p) const {
+				int n = _nArena.load(std::memory_order_acquire);
+				for(int i=0 ; i<n ; i++) {
+					Arena* a = _at(i);
+					if(a->has(p))
+						return a;
+				}
+				return nullptr;
+			}
+			// アリーナを追加 (nSeen: 呼び出し側が見ていたアリーナ数)
+			// 他スレッドが既に追加していた場合はそれを返す (bNew: 新しく追加したか)
+			int _addArena(int nSeen, bool& bNew) {
+				std::lock_guard<std::mutex> lk(_mtxGrow);
+				int n = _nArena.load(std::memory_order_relaxed);
+				bNew = false;
+				if(n > nSeen)
+					return n-1;
+				if(n == MAX_ARENA)
+					return -1;
+				_arena[n].store(new Arena(_szBlock), std::memory_order_release);
+				_nArena.store(n+1, std::memory_order_release);
+				bNew = true;
+				return n;
+			}
+			void* _tryAt(int idx, size_t s, bool bBlock) {
+				Arena* a = _at(idx);
+				if(bBlock)
+					a->lock();
+				else if(!a->tryLock())
+					return nullptr;
+				void* ret = a->tlsf->acquire(s);
+				a->unlock();
+				return ret;
+			}
+
+		public:
+			// sz: アリーナ容量, nSpill: 競合による追加を許すアリーナ数 (0でハードウェアスレッド数)
+			TLSFBlockMT(size_t sz=MAXSIZE, int nSpill=0):
+				_szBlock(std::min(sz, size_t(MAXSIZE))),
+				_nSpill(nSpill > 0 ? nSpill : std::max<int>(std::thread::hardware_concurrency(), 1))
+			{
+				for(auto& a : _arena)
+					a.store(nullptr, std::memory_order_relaxed);
+				_arena[0].store(new Arena(_szBlock), std::memory_order_relaxed);
+				_nArena.store(1, std::memory_order_release);
+			}
+			virtual void destroy() {
+				int n = _nArena.load(std::memory_order_acquire);
+				for(int i=0 ; i<n ; i++)
+					delete _at(i);
+				delete this;
+			}
+
+			void* acquire(size_t s) {
+				// (良適合の丸め上げにより，新しいアリーナでも確保できない大きさは弾く)
+				if(_szBlock-_TLSF::GetPaddingSize() < s || _TLSF::GetArenaSize(s) > _szBlock)
+					throw std::bad_alloc();
+				int& pref = _Pref();
+				for(;;) {
+					int n = _nArena.load(std::memory_order_acquire);
+					int base = pref % n;
+					bool bBusy = false;
+					// 優先アリーナから順にtry-lock
+					for(int i=0 ; i<n ; i++) {
+						int idx = (base+i) % n;
+						Arena* a = _at(idx);
+						if(!a->tryLock()) {
+							bBusy = true;
+							continue;
+						}
+						void* ret = a->tlsf->acquire(s);
+						a->unlock();
+						if(ret) {
+							pref = idx;
+							return ret;
+						}
+					}
+					// 競合のみで追加上限に達しているならロック待ちで再試行
+					if(bBusy && n >= _nSpill) {
+						for(int i=0 ; i<n ; i++) {
+							int idx = (base+i) % n;
+							if(void* ret = _tryAt(idx, s, true)) {
+								pref = idx;
+								return ret;
+							}
+						}
+					}
+					// アリーナを追加して逃がす
+					bool bNew;
+					int idx = _addArena(n, bNew);
+					if(idx < 0)
+						return nullptr;
+					pref = idx;
+					// (自分で追加したアリーナはロックを待ってでも試す)
+					if(void* ret = _tryAt(idx, s, bNew))
+						return ret;
+					// 空のアリーナで確保できないなら何個追加しても同じなので諦める
+					if(bNew)
+						return nullptr;
+				}
+			}
+			void release(void* p) {
+				Arena* a = _find(p);
+				L_ASSERT(a, u8"管轄外メモリが渡された");
+				a->lock();
+				a->tlsf->release(p);
+				a->unlock();
+			}
+			void* reacquire(void* p, size_t s) {
+				Arena* a = _find(p);
+				a->lock();
+				size_t cur_s = a->tlsf->getSegmentSize(p);
+				void* ret = a->tlsf->reacquire(p, s);
+				a->unlock();
+				if(!ret) {
+					// 別アリーナから確保し，コピー
+					if(!(ret = acquire(s)))
+						return nullptr;
+					memcpy(ret, p, cur_s);
+					release(p);
+				}
+				return ret;
+			}
+			size_t getRemainMem() const {
+				size_t count = 0;
+				int n = _nArena.load(std::memory_order_acquire);
+				for(int i=0 ; i<n ; i++) {
+					Arena* a = _at(i);
+					a->lock();
+					count += a->tlsf->getRemainMem();
+					a->unlock();
+				}
+				return count;
+			}
+			// (ブロックの所有者以外はヘッダを書き換えないのでロック不要)
+			size_t getSegmentSize(void* p) const {
+				return _find(p)->tlsf->getSegmentSize(p);
+			}
+			size_t LowFLevelSize() const {
+				return _at(0)->tlsf->LowFLevelSize();
+			}
+			size_t LowBlockSize() const {
+				return _at(0)->tlsf->LowBlockSize();
+			}
+			int getArenaCount() const {
+				return _nArena.load(std::memory_order_acquire);
+			}
+
+			// 複数スレッドからランダムなサイズで確保，サイズ変更，解放を繰り返しテスト
+			// (確保領域に書いた値が壊れていないかを確認)
+			bool unit_test(int nThread, int n) {
+				std::atomic<bool> bOK(true);
+				std::vector<std::thread> th;
+				const size_t modsize = _szBlock / 1024;
+				for(int t=0 ; t<nThread ; t++) {
+					th.emplace_back([this, &bOK, t, n, modsize]() {
+						const int N_PTR = 64;
+						void* ptr[N_PTR] = {};
+						size_t sz[N_PTR] = {};
+						u32 rnd = 0x9e3779b9 * (t+1);
+						auto next = [&rnd]() {
+							rnd ^= rnd << 13;
+							rnd ^= rnd >> 17;
+							rnd ^= rnd << 5;
+							return rnd;
+						};
+						for(int i=0 ; i<n ; i++) {
+							int j = next() % N_PTR;
+							if(ptr[j]) {
+								const u8* c = (const u8*)ptr[j];
+								for(size_t k=0 ; k<sz[j] ; k++) {
+									if(c[k] != (u8)(j+t))
+										bOK = false;
+								}
+								if(next() & 1) {
+									release(ptr[j]);
+									ptr[j] = nullptr;
+									continue;
+								}
+								size_t ns = next() % modsize + 1;
+								ptr[j] = reacquire(ptr[j], ns);
+								memset(ptr[j], (u8)(j+t), ns);
+								sz[j] = ns;
+							} else {
+								sz[j] = next() % modsize + 1;
+								ptr[j] = acquire(sz[j]);
+								memset(ptr[j], (u8)(j+t), sz[j]);
+							}
+						}
+						for(auto* p : ptr) {
+							if(p)
+								release(p);
+						}
+					});
+				}
+				for(auto& t : th)
+					t.join();
+				return bOK;
+			}
+	};
+}
@@ -0,0 +1,194 @@
+#pragma once
+#include "tlsf.h"
+#include <cmath>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <ostream>
+#include <fstream>
+#ifndef MSVC
+	#include <execinfo.h>
+#endif
+
+namespace rs {
+	// サンプリング方式のヒーププロファイラ
+	// 平均periodバイト毎に確保をサンプリングし，その時だけバックトレースを取る
+	// (非サンプル時はカウンタの減算のみ)
+	// 出力はpprofが読めるheap_v2形式
+	class TLSFProfiler : public ImplTLSF {
+		private:
+			const static int MAX_DEPTH = 32,
+							FILTER_BIT = 12;
+			typedef std::vector<void*>	Stack;
+			struct Count {
+				size_t	nLive, szLive,
+						nAlloc, szAlloc;
+				Count(): nLive(0), szLive(0), nAlloc(0), szAlloc(0) {}
+			};
+			typedef std::map<Stack, Count>	BucketMap;
+			struct Sample {
+				Count*	pCount;
+				size_t	size;
+			};
+			typedef std::unordered_map<void*, Sample>	SampleMap;
+
+			ImplTLSF*	_impl;
+			const size_t	_period;
+			// 次のサンプルまでの残りバイト数
+			ptrdiff_t	_left;
+			u64			_rnd;
+
+			BucketMap	_bucket;
+			SampleMap	_live;
+			// サンプル済みポインタの簡易フィルタ (解放時のmap検索を省く)
+			// ハッシュ毎のサンプル数を数え，最後のサンプルが消えたら0に戻す
+			// (255で飽和させ，以後は減らさない)
+			u8			_filter[1<<FILTER_BIT];
+
+			static u32 _Hash(void* p) {
+				return (u32)(((uintptr_t)p * 0x9e3779b97f4a7c15ULL) >> (64-FILTER_BIT));
+			}
+			bool _testFilter(void* p) const {
+				return _filter[_Hash(p)] != 0;
+			}
+			void _setFilter(void* p) {
+				u8& c = _filter[_Hash(p)];
+				if(c != 0xff)
+					++c;
+			}
+			void _resetFilter(void* p) {
+				u8& c = _filter[_Hash(p)];
+				if(c != 0xff)
+					--c;
+			}
+			// 次のサンプル間隔 (平均periodの指数分布)
+			ptrdiff_t _nextInterval() {
+				_rnd ^= _rnd << 13;
+				_rnd ^= _rnd >> 7;
+				_rnd ^= _rnd << 17;
+				double u = ((_rnd >> 11) + 0.5) * (1.0 / (1ULL<<53));
+				return (ptrdiff_t)(-std::log(u) * _period) + 1;
+			}
+			void _sample(void* p, size_t s) {
+				Stack st;
+	#ifndef MSVC
+				void* pc[MAX_DEPTH];
+				int n = backtrace(pc, MAX_DEPTH);
+				// (プロファイラ自身のフレームは除く)
+				if(n > 2)
+					st.assign(pc+2, pc+n);
+	#endif
+				Count& c = _bucket[st];
+				c.nLive++;
+				c.szLive += s;
+				c.nAlloc++;
+				c.szAlloc += s;
+				Sample& sm = _live[p];
+				sm.pCount = &c;
+				sm.size = s;
+				_setFilter(p);
+			}
+			void _unsample(void* p) {
+				auto itr = _live.find(p);
+				if(itr == _live.end())
+					return;
+				Count* c = itr->second.pCount;
+				c->nLive--;
+				c->szLive -= itr->second.size;
+				_live.erase(itr);
+				_resetFilter(p);
+			}
+			// サンプル済みなら生存サイズをsに変更
+			bool _resample(void* p, size_t s) {
+				auto itr = _live.find(p);
+				if(itr == _live.end())
+					return false;
+				Count* c = itr->second.pCount;
+				c->szLive += s - itr->second.size;
+				itr->second.size = s;
+				return true;
+			}
+			void _count(void* p, size_t s) {
+				if((_left -= s) > 0 || !p)
+					return;
+				_left = _nextInterval();
+				_sample(p, s);
+			}
+
+		public:
+			// impl: 計測対象のアロケータ (destroyで一緒に破棄する)
+			TLSFProfiler(ImplTLSF* impl, size_t period=512*1024, u64 seed=0x2545f4914f6cdd1dULL):
+				_impl(impl), _period(std::max(period, size_t(1))), _rnd(seed ? seed : 1)
+			{
+				memset(_filter, 0, sizeof(_filter));
+				_left = _nextInterval();
+			}
+			void* acquire(size_t s) {
+				void* ret = _impl->acquire(s);
+				_count(ret, s);
+				return ret;
+			}
+			void* reacquire(void* p, size_t s) {
+				void* ret = _impl->reacquire(p, s);
+				// (失敗時は元の領域が生きているのでサンプルを残す)
+				if(!ret)
+					return ret;
+				if(_testFilter(p)) {
+					// その場で伸縮した場合はサンプルのサイズだけ更新
+					if(ret == p && _resample(p, s))
+						return ret;
+					if(ret != p)
+						_unsample(p);
+				}
+				_count(ret, s);
+				return ret;
+			}
+			void release(void* p) {
+				if(_testFilter(p))
+					_unsample(p);
+				_impl->release(p);
+			}
+			size_t getRemainMem() const { return _impl->getRemainMem(); }
+			size_t getSegmentSize(void* p) const { return _impl->getSegmentSize(p); }
+			size_t LowFLevelSize() const { return _impl->LowFLevelSize(); }
+			size_t LowBlockSize() const { return _impl->LowBlockSize(); }
+			virtual void destroy() {
+				_impl->destroy();
+				delete this;
+			}
+
+			// 生存中/累計のプロファイルをheap_v2形式で出力
+			// (生存中 = inuse, 累計 = alloc としてpprofで選択できる)
+			void dump(std::ostream& os) const {
+				Count total;
+				for(auto& b : _bucket) {
+					total.nLive += b.second.nLive;
+					total.szLive += b.second.szLive;
+					total.nAlloc += b.second.nAlloc;
+					total.szAlloc += b.second.szAlloc;
+				}
+				os << "heap profile: " << total.nLive << ": " << total.szLive
+					<< " [" << total.nAlloc << ": " << total.szAlloc
+					<< "] @ heap_v2/" << _period << '\n';
+				for(auto& b : _bucket) {
+					const Count& c = b.second;
+					os << c.nLive << ": " << c.szLive
+						<< " [" << c.nAlloc << ": " << c.szAlloc << "] @";
+					for(void* pc : b.first)
+						os << ' ' << pc;
+					os << '\n';
+				}
+				// アドレスからシンボルを引く為のマッピング情報
+				os << "\nMAPPED_LIBRARIES:\n";
+	#ifndef MSVC
+				std::ifstream ifs("/proc/self/maps");
+				if(ifs)
+					os << ifs.rdbuf();
+	#endif
+			}
+			// 生存中のサンプル数
+			size_t getLiveSamples() const {
+				return _live.size();
+			}
+	};
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "tlsf.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace rs {
+	// バックグラウンドで定期的に空きページを返却するスレッド
+	// T: purge(size_t, bool)を持つアロケータ (TLSF, TLSFBlock)
+	// アロケータ自体はスレッドセーフではないので，利用側と同じmutexで保護する
+	template <class T>
+	class TLSFPurger {
+		private:
+			T&			_alc;
+			std::mutex&	_mtx;
+			const size_t	_threshold;
+			const bool		_bLazy;
+			const std::chrono::milliseconds	_interval;
+
+			std::thread				_th;
+			std::mutex				_mtxRun;
+			std::condition_variable	_cv;
+			bool					_bRun;
+			size_t					_sz_purged;
+
+			void _loop() {
+				std::unique_lock<std::mutex> lk(_mtxRun);
+				while(_bRun) {
+					if(_cv.wait_for(lk, _interval, [this](){ return !_bRun; }))
+						break;
+					lk.unlock();
+					size_t sz;
+					{
+						std::lock_guard<std::mutex> alk(_mtx);
+						sz = _alc.purge(_threshold, _bLazy);
+					}
+					lk.lock();
+					_sz_purged += sz;
+				}
+			}
+
+		public:
+			// interval: 返却処理の間隔, threshold: 対象とする空きブロックの最小サイズ
+			TLSFPurger(T& alc, std::mutex& mtx, std::chrono::milliseconds interval, size_t threshold, bool bLazy=false):
+				_alc(alc), _mtx(mtx), _threshold(threshold), _bLazy(bLazy), _interval(interval),
+				_bRun(false), _sz_purged(0) {}
+			~TLSFPurger() {
+				stop();
+			}
+			void start() {
+				std::lock_guard<std::mutex> lk(_mtxRun);
+				if(_bRun)
+					return;
+				_bRun = true;
+				_th = std::thread(&TLSFPurger::_loop, this);
+			}
+			void stop() {
+				{
+					std::lock_guard<std::mutex> lk(_mtxRun);
+					if(!_bRun)
+						return;
+					_bRun = false;
+				}
+				_cv.notify_all();
+				_th.join();
+			}
+			// これまでに返却したバイト数
+			size_t getPurgedMem() {
+				std::lock_guard<std::mutex> lk(_mtxRun);
+				return _sz_purged;
+			}
+	};
+}
@@ -1,4 +1,9 @@
 #include "tlsf.h"
+#include "tlsf_purge.h"
+#include "tlsf_profile.h"
+#include "tlsf_mt.h"
+#include "tlsf_heapmap.h"
+#include <sstream>
 using namespace rs;
 
 int main() {
@@ -6,5 +11,307 @@ int main() {
 	u8* buff = new u8[bs];
 	TLSF<24,4,4,true> tls(buff, bs);
 	tls.unit_test(1000);
+	// パラメータ自動導出 (NMemBit=22, NBit0=5, NBit1=4)
+	{
+		typedef TLSFParam<4, (1<<22)-1, 7>::Alloc<true>::type TLSFAuto;
+		u8* buff2 = new u8[1<<21];
+		TLSFAuto tls2(buff2, 1<<21);
+		tls2.unit_test(100);
+		delete[] buff2;
+	}
+	// 64bitワードのビットテーブル (NBit1=6) と3レベル (NBit1=7,8)
+	{
+		u8* buff2 = new u8[1<<21];
+		{
+			TLSF<22,4,6,true> tls6(buff2, 1<<21);
+			tls6.unit_test(100);
+		}
+		{
+			typedef TLSFParam<4, (1<<22)-1, 1>::Alloc<true>::type TLSF7;
+			TLSF7 tls7(buff2, 1<<21);
+			tls7.unit_test(100);
+		}
+		{
+			TLSF<22,4,8,true> tls8(buff2, 1<<21);
+			tls8.setDeferredCoalesce(1<<18, 16);
+			tls8.unit_test(100);
+			tls8.flushDeferred();
+			tls8.check();
+		}
+		delete[] buff2;
+	}
+	// 遅延結合モード
+	size_t remain = tls.getRemainMem();
+	tls.setDeferredCoalesce(bs/4, 16);
+	tls.unit_test(1000);
+	tls.flushDeferred();
+	tls.check();
+	if(tls.getRemainMem() != remain)
+		return 1;
+	// クイックリストに細切れで残っていても，メモリ不足とする前に全て結合して確保する
+	{
+		const size_t bs2 = 1<<19;
+		u8* buff2 = new u8[bs2];
+		TLSF<20,4,4,false> tls2(buff2, bs2);
+		tls2.setDeferredCoalesce(bs2, 16);
+		std::vector<void*> ptr;
+		while(void* p = tls2.acquire(200))
+			ptr.push_back(p);
+		for(void* p : ptr)
+			tls2.release(p);
+		void* p = tls2.acquire(bs2/4);
+		if(!p)
+			return 1;
+		tls2.release(p);
+		tls2.flushDeferred();
+		tls2.check();
+		delete[] buff2;
+	}
+
+	// 空きページの返却
+	{
+		std::mutex mtx;
+		// (new[]で確保したバッファなので返却済みページはゼロ埋めされる)
+		tls.setPurgeZeroFill(true);
+		TLSFPurger<TLSF<24,4,4,true> > pg(tls, mtx, std::chrono::milliseconds(1), bs/16);
+		pg.start();
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		pg.stop();
+		if(pg.getPurgedMem() == 0)
+			return 1;
+		u8* p = (u8*)tls.acquireZero(bs/2);
+		for(size_t i=0 ; i<bs/2 ; i++) {
+			if(p[i] != 0)
+				return 1;
+		}
+		tls.release(p);
+		tls.check();
+#ifndef TLSF_MEMFILL
+		// 返却済みページの内部はacquireZeroで書き込まない (make nofillで確認)
+		TLSFNew<20,4,4,false>* heap = new TLSFNew<20,4,4,false>();
+		const size_t sz = 1<<18,
+					pgsz = sysconf(_SC_PAGESIZE);
+		p = (u8*)heap->acquire(sz);
+		memset(p, 0xff, sz);
+		heap->release(p);
+		if(heap->purge(sz/4) == 0)
+			return 1;
+		p = (u8*)heap->acquireZero(sz);
+		uintptr_t beg = ((uintptr_t)p + pgsz-1) & ~(pgsz-1),
+				end = ((uintptr_t)p + sz) & ~(pgsz-1);
+		std::vector<unsigned char> vec((end-beg) / pgsz);
+		if(mincore((void*)beg, end-beg, vec.data()) != 0)
+			return 1;
+		for(unsigned char v : vec) {
+			if(v & 1)
+				return 1;
+		}
+		for(size_t i=0 ; i<sz ; i++) {
+			if(p[i] != 0)
+				return 1;
+		}
+		heap->release(p);
+		heap->destroy();
+#endif
+	}
+	// タグ別の上限
+	{
+		typedef TLSFBlock<20,4,4> Block;
+		Block* blk = new Block();
+		blk->tagTable().setBudget(1, 4096, TLSFTag::Budget_Hard);
+		void* p0 = blk->acquire(3000, 1);
+		if(!p0 || blk->acquire(3000, 1) ||
+			blk->tagTable().getLiveCount(1) != 1)
+			return 1;
+		void* p1 = blk->acquire(1<<19, 2);
+		p1 = blk->reacquire(p1, 1<<19 | 1<<18);
+		if(blk->getTag(p1) != 2 ||
+			blk->tagTable().getLiveMem(2) != blk->getSegmentSize(p1))
+			return 1;
+		blk->release(p0);
+		blk->release(p1);
+		if(blk->tagTable().getLiveMem(1) != 0 || blk->tagTable().getLiveMem(2) != 0)
+			return 1;
+		blk->destroy();
+		// 丸め上げで要求より大きなブロックが割り当てられても上限を超えない
+		TLSFNew<20,4,4,false>* heap = new TLSFNew<20,4,4,false>(1<<16);
+		void* pa = heap->acquire(1080);
+		void* pb = heap->acquire(64);
+		heap->release(pa);
+		heap->tagTable().setBudget(3, 1050, TLSFTag::Budget_Hard);
+		if(heap->acquire(1000, 3) || heap->tagTable().getLiveMem(3) != 0)
+			return 1;
+		heap->release(pb);
+		heap->destroy();
+	}
+	// ヒープ走査
+	{
+		typedef TLSFNew<20,4,4,false> Heap;
+		Heap* heap = new Heap();
+		void* ptr[64];
+		for(int i=0 ; i<64 ; i++)
+			ptr[i] = heap->acquire(1000 + i*100);
+		for(int i=0 ; i<64 ; i+=2)
+			heap->release(ptr[i]);
+		// 分割走査の途中で走査位置のブロックを結合させる
+		// (ptr[0],ptr[1]まで走査した所でptr[1]を解放すると，走査位置のptr[2]はptr[0]へ統合され
+		//  続きは統合後のブロックから辿り直す)
+		TLSFHeapStat st;
+		size_t nBlock = 0;
+		heap->walk([&nBlock](const TLSFBlockInfo&) { ++nBlock; }, 2);
+		heap->release(ptr[1]);
+		void* pResume = nullptr;
+		while(!heap->walk([&nBlock, &pResume](const TLSFBlockInfo& bi) {
+			if(!pResume)
+				pResume = bi.ptr;
+			++nBlock;
+		}, 3));
+		size_t nAll = 0;
+		heap->walk([&nAll](const TLSFBlockInfo&) { ++nAll; });
+		st = CollectHeapStat(*heap);
+		if(pResume != ptr[0] || nBlock != 2+nAll || st.nBlock != nAll ||
+			st.szFree != heap->getRemainMem() ||
+			st.nUse != 31 ||
+			!heap->acquire(st.szFit))
+			return 1;
+		std::ostringstream ss;
+		TLSFNullLock lk;
+		DumpHeapJSON(*heap, lk, ss, 8);
+		if(ss.str().compare(0, 11, "{\"blocks\":[") != 0)
+			return 1;
+		heap->destroy();
+	}
+	// 領域追加ポリシー
+	{
+		typedef TLSFBlock<20,4,4> Block;
+		Block* blk = new Block(1<<16);
+		blk->setGrowPolicy(TLSFGrow::Capped(TLSFGrow::Geometric(1<<16, 2.0), 1<<19));
+		if(!blk->reserve(1<<17) || blk->getRemainMem() < (1<<17))
+			return 1;
+		// 上限を超える分はハンドラを呼んでから失敗する
+		int nOOM = 0;
+		blk->setOOMHandler([&nOOM](size_t) { return ++nOOM < 3; });
+		void* p0 = blk->acquire(1<<18);
+		void* p1 = blk->acquire(1<<18);
+		if(!p0 || p1 || nOOM != 3 || blk->getTotalMem() > (1<<19))
+			return 1;
+		blk->release(p0);
+		blk->destroy();
+		// 最初の領域が埋まっても64個を超えて領域を追加できる
+		blk = new Block(1<<12);
+		void* ptr[100];
+		for(int i=0 ; i<100 ; i++) {
+			if(!(ptr[i] = blk->acquire(3000)))
+				return 1;
+		}
+		if(blk->getArenaCount() < 100)
+			return 1;
+		for(int i=0 ; i<100 ; i++)
+			blk->release(ptr[i]);
+		blk->destroy();
+	}
+	// 寿命ヒント
+	{
+		TLSFNew<20,4,4,false>* heap = new TLSFNew<20,4,4,false>(1<<16);
+		void* pl = heap->acquire(256, 0, LT_Long);
+		void* ps = heap->acquire(256, 0, LT_Short);
+		void* pl2 = heap->acquire(256, 0, LT_Long);
+		// 長寿命は先頭側に詰まり，短寿命は末尾側
+		if(!(pl < pl2 && pl2 < ps))
+			return 1;
+		heap->check();
+		heap->release(ps);
+		heap->release(pl);
+		heap->release(pl2);
+		if(!heap->isEmpty())
+			return 1;
+		heap->destroy();
+
+		typedef TLSFBlock<20,4,4> Block;
+		Block* blk = new Block(1<<14);
+		void* pLong = blk->acquire(128, 0, LT_Long);
+		void* ptr[64];
+		for(int i=0 ; i<64 ; i++)
+			ptr[i] = blk->acquire(1024, 0, LT_Short);
+		// 短寿命は別領域に置かれ，空になった領域は削除される
+		int nArena = blk->getArenaCount();
+		if(nArena < 3 || !blk->hasPointer(pLong))
+			return 1;
+		for(int i=0 ; i<64 ; i++)
+			blk->release(ptr[i]);
+		if(blk->getArenaCount() != 2 || blk->getTotalMem() >= size_t(nArena)<<14)
+			return 1;
+		blk->release(pLong);
+		blk->destroy();
+
+		// 再確保中のメモリ不足ハンドラで短寿命領域が削除されても元の領域へ解放される
+		blk = new Block(1<<14);
+		blk->setGrowPolicy(TLSFGrow::Capped(TLSFGrow::Fixed(1<<14), 3<<14));
+		void* q = blk->acquire(12000, 0, LT_Short);
+		void* p = blk->acquire(6000, 0, LT_Short);
+		void* f = blk->acquire(9000, 0, LT_Short);
+		if(blk->getArenaCount() != 3)
+			return 1;
+		blk->setOOMHandler([&blk, &q](size_t) {
+			if(!q)
+				return false;
+			blk->release(q);
+			q = nullptr;
+			return true;
+		});
+		p = blk->reacquire(p, 12000);
+		if(!p || q)
+			return 1;
+		blk->release(f);
+		blk->release(p);
+		if(blk->getArenaCount() != 2)
+			return 1;
+		blk->destroy();
+	}
+	// サンプリングプロファイラ
+	{
+		TLSFProfiler* prof = new TLSFProfiler(new TLSFNew<24,4,4,false>(), 4096);
+		void* ptr[256];
+		for(int i=0 ; i<256 ; i++)
+			ptr[i] = prof->acquire(1024);
+		for(int i=0 ; i<256 ; i+=2)
+			prof->release(ptr[i]);
+		std::ostringstream ss;
+		prof->dump(ss);
+		if(prof->getLiveSamples() == 0 ||
+			ss.str().compare(0, 13, "heap profile:") != 0)
+			return 1;
+		for(int i=1 ; i<256 ; i+=2)
+			prof->release(ptr[i]);
+		if(prof->getLiveSamples() != 0)
+			return 1;
+		prof->destroy();
+		// 再確保に失敗した領域のサンプルは残る
+		prof = new TLSFProfiler(new TLSFNew<20,4,4,false>(), 1);
+		void* p = prof->acquire(1024);
+		if(prof->getLiveSamples() != 1 || prof->reacquire(p, 1<<21) || prof->getLiveSamples() != 1)
+			return 1;
+		p = prof->reacquire(p, 2048);
+		prof->release(p);
+		if(prof->getLiveSamples() != 0)
+			return 1;
+		prof->destroy();
+	}
+	// マルチスレッド
+	{
+		TLSFBlockMT<22,4,4>* mt = new TLSFBlockMT<22,4,4>(size_t(1<<22)-1, 4);
+		if(!mt->unit_test(8, 20000))
+			return 1;
+		mt->destroy();
+		// 丸め上げで1つのアリーナに収まらない要求はアリーナを増やさずに失敗する
+		mt = new TLSFBlockMT<22,4,4>(size_t(1<<22)-1, 2);
+		try {
+			mt->acquire((1<<22)-4096);
+			return 1;
+		} catch(const std::bad_alloc&) {}
+		if(mt->getArenaCount() != 1)
+			return 1;
+		mt->destroy();
+	}
     	return 0;
 }
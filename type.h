@@ -176,4 +176,26 @@ template <class T> struct _RawType<const T> { typedef T result; };
 template <class T> struct RawType { typedef typename _RawType<T>::result result; };
 template <class T> struct RawType<T*> { typedef typename _RawType<T>::result result; };
 template <class T> struct RawType<T&> { typedef typename _RawType<T>::result result; };
-template <class T> struct RawType<T&&> { typedef typename _RawType<T>::result result; };
\ No newline at end of file
+template <class T> struct RawType<T&&> { typedef typename _RawType<T>::result result; };
+// 整数列 (0,1,...,N-1) ※テンプレートの再帰深さはlogN
+template <int... N>
+struct IndexSeq {};
+template <class S0, class S1>
+struct ConcatSeq;
+template <int... N0, int... N1>
+struct ConcatSeq< IndexSeq<N0...>, IndexSeq<N1...> > {
+	typedef IndexSeq<N0..., (sizeof...(N0)+N1)...> type;
+};
+template <int N>
+struct MakeIndexSeq {
+	typedef typename ConcatSeq<typename MakeIndexSeq<N/2>::type,
+								typename MakeIndexSeq<N-N/2>::type>::type type;
+};
+template <>
+struct MakeIndexSeq<0> {
+	typedef IndexSeq<> type;
+};
+template <>
+struct MakeIndexSeq<1> {
+	typedef IndexSeq<0> type;
+};
\ No newline at end of file